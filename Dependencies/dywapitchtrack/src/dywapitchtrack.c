@@ -101,32 +101,57 @@ int dywapitch_neededsamplecount(int minFreq) {
 	return nbSam;
 }
 
+int dywapitch_framesizeforsamplerate(int framesizeat44100, double samplerate) {
+	// nearest power of 2 multiple of the 44100 frame, so the window covers about the same time span
+	int multiple = 1;
+	while (samplerate/44100. >= multiple*1.5) multiple *= 2;
+	return framesizeat44100*multiple;
+}
+
 typedef struct _minmax {
 	int index;
 	struct _minmax *next;
 } minmax;
 
-double _dywapitch_computeWaveletPitch(double * samples, int startsample, int samplecount) {
+int dywapitch_neededworkspace(int samplecount) {
+	samplecount = _floor_power2(samplecount);
+	return (int)(sizeof(double)*samplecount + 3*sizeof(int)*samplecount);
+}
+
+void dywapitch_initworkspace(dywapitchworkspace *workspace, void *memory, int samplecount) {
+	samplecount = _floor_power2(samplecount);
+	workspace->sam = (double *)memory;
+	workspace->distances = (int *)(workspace->sam + samplecount);
+	workspace->mins = workspace->distances + samplecount;
+	workspace->maxs = workspace->mins + samplecount;
+	workspace->capacity = samplecount;
+}
+
+// runs on the samplecount (a power of 2) samples already copied into workspace->sam
+double _dywapitch_computeWaveletPitchInWorkspace(dywapitchworkspace *workspace, int samplecount, double samplerate) {
 	double pitchF = 0.0;
 	
 	int i, j;
 	double si, si1;
 	
-	// must be a power of 2
-	samplecount = _floor_power2(samplecount);
-	
-	double *sam = (double *)malloc(sizeof(double)*samplecount);
-	memcpy(sam, samples + startsample, sizeof(double)*samplecount);
+	double *sam = workspace->sam;
 	int curSamNb = samplecount;
 	
-	int *distances = (int *)malloc(sizeof(int)*samplecount);
-	int *mins = (int *)malloc(sizeof(int)*samplecount);
-	int *maxs = (int *)malloc(sizeof(int)*samplecount);
+	int *distances = workspace->distances;
+	int *mins = workspace->mins;
+	int *maxs = workspace->maxs;
 	int nbMins, nbMaxs;
 	
 	// algorithm parameters
 	int maxFLWTlevels = 6;
 	double maxF = 3000.;
+	
+	// one more level per doubling of the samplerate above 44100, so the lowest analysed band stays put
+	double rateRatio = samplerate/44100.;
+	while (rateRatio >= 1.5) {
+		maxFLWTlevels++;
+		rateRatio /= 2.;
+	}
 	int differenceLevelsN = 3;
 	double maximaThresholdRatio = 0.75;
 	
@@ -161,7 +186,7 @@ double _dywapitch_computeWaveletPitch(double * samples, int startsample, int sam
 	while(1) {
 		
 		// delta
-		delta = 44100./(_2power(curLevel)*maxF);
+		delta = samplerate/(_2power(curLevel)*maxF);
 		//("dywapitch doing level=%ld delta=%ld\n", curLevel, delta);
 		
 		if (curSamNb < 2) goto cleanup;
@@ -303,7 +328,7 @@ double _dywapitch_computeWaveletPitch(double * samples, int startsample, int sam
 				//if DEBUGG then put "similarity="&similarity&&"delta="&delta&&"ok"
  				//asLog("dywapitch similarity=%f OK !\n", similarity);
 				// two consecutive similar mode distances : ok !
-				pitchF = 44100./(_2power(curLevel-1)*curModeDistance);
+				pitchF = samplerate/(_2power(curLevel-1)*curModeDistance);
 				goto cleanup;
 			}
 			//if DEBUGG then put "similarity="&similarity&&"delta="&delta&&"not"
@@ -332,10 +357,40 @@ double _dywapitch_computeWaveletPitch(double * samples, int startsample, int sam
 	
 	///
 cleanup:
-	free(distances);
-	free(mins);
-	free(maxs);
-	free(sam);
+	return pitchF;
+}
+
+double _dywapitch_computeWaveletPitchWs(dywapitchworkspace *workspace, double * samples, int startsample, int samplecount) {
+	// must be a power of 2
+	samplecount = _floor_power2(samplecount);
+	if (samplecount > workspace->capacity) return 0.0;
+	
+	memcpy(workspace->sam, samples + startsample, sizeof(double)*samplecount);
+	return _dywapitch_computeWaveletPitchInWorkspace(workspace, samplecount, 44100.);
+}
+
+double _dywapitch_computeWaveletPitchFloat(dywapitchworkspace *workspace, const float * samples, int startsample, int samplecount, double samplerate) {
+	int i;
+	
+	// must be a power of 2
+	samplecount = _floor_power2(samplecount);
+	if (samplecount > workspace->capacity) return 0.0;
+	
+	// the copy into the workspace doubles as the float to double conversion
+	for (i = 0; i < samplecount; i++) workspace->sam[i] = samples[startsample + i];
+	return _dywapitch_computeWaveletPitchInWorkspace(workspace, samplecount, samplerate);
+}
+
+// original allocating entry point, kept as a thin wrapper around the workspace version
+double _dywapitch_computeWaveletPitch(double * samples, int startsample, int samplecount) {
+	dywapitchworkspace workspace;
+	void *memory = malloc(dywapitch_neededworkspace(samplecount));
+	double pitchF;
+	
+	if (memory == NULL) return 0.0;
+	dywapitch_initworkspace(&workspace, memory, samplecount);
+	pitchF = _dywapitch_computeWaveletPitchWs(&workspace, samples, startsample, samplecount);
+	free(memory);
 	
 	return pitchF;
 }
@@ -449,5 +504,15 @@ double dywapitch_computepitch(dywapitchtracker *pitchtracker, double * samples,
 	return _dywapitch_dynamicprocess(pitchtracker, raw_pitch);
 }
 
+double dywapitch_computepitch_ws(dywapitchtracker *pitchtracker, dywapitchworkspace *workspace, double * samples, int startsample, int samplecount) {
+	double raw_pitch = _dywapitch_computeWaveletPitchWs(workspace, samples, startsample, samplecount);
+	return _dywapitch_dynamicprocess(pitchtracker, raw_pitch);
+}
+
+double dywapitch_computepitchf(dywapitchtracker *pitchtracker, dywapitchworkspace *workspace, const float * samples, int startsample, int samplecount, double samplerate) {
+	double raw_pitch = _dywapitch_computeWaveletPitchFloat(workspace, samples, startsample, samplecount, samplerate);
+	return _dywapitch_dynamicprocess(pitchtracker, raw_pitch);
+}
+
 
 
@@ -57,8 +57,10 @@
  over time and makes assumptions about human voice capabilities and reallife conditions
  (as documented inside the code).
  
- Note : The algorithm currently assumes a 44100Hz audio sampling rate. If you use a different
- samplerate, you can just multiply the resulting pitch by the ratio between your samplerate and 44100.
+ Note : dywapitch_computepitch and dywapitch_computepitch_ws assume a 44100Hz audio sampling rate. If you
+ use a different samplerate, you can just multiply the resulting pitch by the ratio between your samplerate
+ and 44100. dywapitch_computepitchf takes the samplerate as a parameter instead; pair it with
+ dywapitch_framesizeforsamplerate to keep the analysis window the same length in time.
 */
 
 /* Usage
@@ -72,6 +74,13 @@
  // For each available audio buffer, call 'dywapitch_computepitch'
  double thepitch = dywapitch_computepitch(&pitchtracker, samples, start, count);
  
+ // To analyze without any heap allocation (e.g. on an audio thread), size a workspace once
+ // for the largest sample count you will pass, and use 'dywapitch_computepitch_ws' instead.
+ dywapitchworkspace workspace;
+ void *memory = malloc(dywapitch_neededworkspace(count));
+ dywapitch_initworkspace(&workspace, memory, count);
+ double thepitch = dywapitch_computepitch_ws(&pitchtracker, &workspace, samples, start, count);
+ 
 */
 
 #ifndef dywapitchtrack__H
@@ -87,11 +96,24 @@ typedef struct _dywapitchtracker {
 	int		_pitchConfidence;
 } dywapitchtracker;
 
+// scratch memory for one pitch computation, laid out inside caller-owned memory
+typedef struct _dywapitchworkspace {
+	double	*sam;
+	int		*distances;
+	int		*mins;
+	int		*maxs;
+	int		capacity;
+} dywapitchworkspace;
+
 // returns the number of samples needed to compute pitch for fequencies equal and above the given minFreq (in Hz)
 // useful to allocate large enough audio buffer 
 // ex : for frequencies above 130Hz, you need 1024 samples (assuming a 44100 Hz samplerate)
 int dywapitch_neededsamplecount(int minFreq);
 
+// scales a frame size chosen for 44100 Hz to the given samplerate, keeping it a power of 2
+// ex : 1024 at 44100 or 48000 Hz, 2048 at 88200 or 96000 Hz, 4096 at 176400 or 192000 Hz
+int dywapitch_framesizeforsamplerate(int framesizeat44100, double samplerate);
+
 // call before computing any pitch, passing an allocated dywapitchtracker structure
 void dywapitch_inittracking(dywapitchtracker *pitchtracker);
 
@@ -102,6 +124,20 @@ void dywapitch_inittracking(dywapitchtracker *pitchtracker);
 // return 0.0 if no pitch was found (sound too low, noise, etc..)
 double dywapitch_computepitch(dywapitchtracker *pitchtracker, double * samples, int startsample, int samplecount);
 
+// returns the number of bytes of workspace memory needed to compute pitch over samplecount samples
+int dywapitch_neededworkspace(int samplecount);
+
+// lays out a workspace inside memory, which must hold at least dywapitch_neededworkspace(samplecount) bytes
+// and stay alive as long as the workspace is used. samplecount is the largest count that will be passed.
+void dywapitch_initworkspace(dywapitchworkspace *workspace, void *memory, int samplecount);
+
+// same as dywapitch_computepitch, but never allocates: all scratch memory comes from the workspace.
+// reentrant as long as each thread uses its own tracker and workspace
+double dywapitch_computepitch_ws(dywapitchtracker *pitchtracker, dywapitchworkspace *workspace, double * samples, int startsample, int samplecount);
+
+// float input at any samplerate, without allocating. returns the pitch in Hz at that samplerate
+double dywapitch_computepitchf(dywapitchtracker *pitchtracker, dywapitchworkspace *workspace, const float * samples, int startsample, int samplecount, double samplerate);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
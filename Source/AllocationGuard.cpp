@@ -0,0 +1,158 @@
+// AllocationGuard.cpp
+
+#include "AllocationGuard.h"
+
+#if COUNTERTUNE_ALLOCATION_GUARD
+
+#include <cstdlib>
+#include <new>
+
+#if JUCE_WINDOWS
+ #include <crtdbg.h>
+ #include <malloc.h>
+#endif
+
+namespace
+{
+    thread_local int realtimeDepth = 0;
+    thread_local int allowDepth = 0;
+
+    void checkAllocation() noexcept
+    {
+        if (realtimeDepth > 0 && allowDepth == 0)
+        {
+            // jassert itself may allocate while logging, so let it through.
+            ++allowDepth;
+            jassertfalse; // heap allocation on the audio thread
+            --allowDepth;
+        }
+    }
+
+    // The operators below have already been checked; this keeps the malloc hooks from reporting them twice.
+    void* uncheckedMalloc(std::size_t size) noexcept
+    {
+        ++allowDepth;
+        auto* p = std::malloc(size == 0 ? 1 : size);
+        --allowDepth;
+        return p;
+    }
+
+    void* uncheckedAlignedMalloc(std::size_t size, std::size_t alignment) noexcept
+    {
+        ++allowDepth;
+        void* p = nullptr;
+       #if JUCE_WINDOWS
+        p = _aligned_malloc(size == 0 ? 1 : size, alignment);
+       #else
+        if (posix_memalign(&p, juce::jmax(alignment, sizeof(void*)), size == 0 ? 1 : size) != 0)
+            p = nullptr;
+       #endif
+        --allowDepth;
+        return p;
+    }
+
+    void alignedFree(void* p) noexcept
+    {
+       #if JUCE_WINDOWS
+        _aligned_free(p);
+       #else
+        std::free(p);
+       #endif
+    }
+
+    void* allocateOrThrow(std::size_t size)
+    {
+        checkAllocation();
+
+        if (auto* p = uncheckedMalloc(size))
+            return p;
+
+        throw std::bad_alloc();
+    }
+
+    void* allocateNoThrow(std::size_t size) noexcept
+    {
+        checkAllocation();
+        return uncheckedMalloc(size);
+    }
+
+    void* allocateAlignedOrThrow(std::size_t size, std::align_val_t alignment)
+    {
+        checkAllocation();
+
+        if (auto* p = uncheckedAlignedMalloc(size, static_cast<std::size_t>(alignment)))
+            return p;
+
+        throw std::bad_alloc();
+    }
+
+    void* allocateAlignedNoThrow(std::size_t size, std::align_val_t alignment) noexcept
+    {
+        checkAllocation();
+        return uncheckedAlignedMalloc(size, static_cast<std::size_t>(alignment));
+    }
+
+   #if JUCE_WINDOWS && defined (_DEBUG)
+    // JUCE's HeapBlock and AudioBuffer allocate with malloc rather than new. The debug CRT (this project
+    // builds against it in Debug) reports every heap call to an allocation hook, which catches those too.
+    int crtAllocationHook(int allocationType, void*, std::size_t, int blockType, long, const unsigned char*, int)
+    {
+        if (blockType != _CRT_BLOCK && (allocationType == _HOOK_ALLOC || allocationType == _HOOK_REALLOC))
+            checkAllocation();
+
+        return TRUE;
+    }
+
+    const struct CrtHookInstaller
+    {
+        CrtHookInstaller() noexcept { _CrtSetAllocHook(crtAllocationHook); }
+    } crtHookInstaller;
+   #endif
+}
+
+void AllocationGuard::enterRealtime() noexcept { ++realtimeDepth; }
+void AllocationGuard::exitRealtime() noexcept  { --realtimeDepth; }
+void AllocationGuard::enterAllow() noexcept    { ++allowDepth; }
+void AllocationGuard::exitAllow() noexcept     { --allowDepth; }
+
+void* operator new (std::size_t size)                                   { return allocateOrThrow(size); }
+void* operator new[] (std::size_t size)                                 { return allocateOrThrow(size); }
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept   { return allocateNoThrow(size); }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept { return allocateNoThrow(size); }
+
+void operator delete (void* p) noexcept                                 { std::free(p); }
+void operator delete[] (void* p) noexcept                               { std::free(p); }
+void operator delete (void* p, std::size_t) noexcept                    { std::free(p); }
+void operator delete[] (void* p, std::size_t) noexcept                  { std::free(p); }
+void operator delete (void* p, const std::nothrow_t&) noexcept          { std::free(p); }
+void operator delete[] (void* p, const std::nothrow_t&) noexcept        { std::free(p); }
+
+// Over-aligned types (alignas above the default, e.g. SIMD registers) come through these instead
+void* operator new (std::size_t size, std::align_val_t alignment)                                   { return allocateAlignedOrThrow(size, alignment); }
+void* operator new[] (std::size_t size, std::align_val_t alignment)                                 { return allocateAlignedOrThrow(size, alignment); }
+void* operator new (std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept   { return allocateAlignedNoThrow(size, alignment); }
+void* operator new[] (std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocateAlignedNoThrow(size, alignment); }
+
+void operator delete (void* p, std::align_val_t) noexcept                                 { alignedFree(p); }
+void operator delete[] (void* p, std::align_val_t) noexcept                               { alignedFree(p); }
+void operator delete (void* p, std::size_t, std::align_val_t) noexcept                    { alignedFree(p); }
+void operator delete[] (void* p, std::size_t, std::align_val_t) noexcept                  { alignedFree(p); }
+void operator delete (void* p, std::align_val_t, const std::nothrow_t&) noexcept          { alignedFree(p); }
+void operator delete[] (void* p, std::align_val_t, const std::nothrow_t&) noexcept        { alignedFree(p); }
+
+#if JUCE_LINUX && defined (__GLIBC__)
+// glibc lets an executable interpose malloc itself, so in the console tools the malloc family is checked as
+// well. (A plugin loaded into a host can't interpose it; its own calls still go to the host's malloc.)
+extern "C"
+{
+    void* __libc_malloc (std::size_t);
+    void* __libc_calloc (std::size_t, std::size_t);
+    void* __libc_realloc (void*, std::size_t);
+
+    void* malloc (std::size_t size) noexcept                    { checkAllocation(); return __libc_malloc (size); }
+    void* calloc (std::size_t count, std::size_t size) noexcept { checkAllocation(); return __libc_calloc (count, size); }
+    void* realloc (void* p, std::size_t size) noexcept          { checkAllocation(); return __libc_realloc (p, size); }
+}
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+// AllocationGuard.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Debug-build check that the audio thread never touches the heap. While a ScopedRealtime is alive
+// on a thread, any operator new on that thread (aligned or not) trips a jassert. ScopedAllow carves out
+// the few places that are still allowed to allocate (host callbacks, cycle-end bookkeeping).
+// JUCE's HeapBlock and AudioBuffer::setSize use malloc rather than new. Those are caught through the
+// debug CRT's allocation hook on Windows and, in the console tools, by interposing malloc on Linux; on
+// macOS only operator new is checked, so a stray malloc there goes unnoticed.
+// Define COUNTERTUNE_DISABLE_ALLOCATION_GUARD to turn it off in a debug build.
+
+#if JUCE_DEBUG && ! defined (COUNTERTUNE_DISABLE_ALLOCATION_GUARD)
+ #define COUNTERTUNE_ALLOCATION_GUARD 1
+#else
+ #define COUNTERTUNE_ALLOCATION_GUARD 0
+#endif
+
+namespace AllocationGuard
+{
+#if COUNTERTUNE_ALLOCATION_GUARD
+    void enterRealtime() noexcept;
+    void exitRealtime() noexcept;
+    void enterAllow() noexcept;
+    void exitAllow() noexcept;
+#else
+    inline void enterRealtime() noexcept {}
+    inline void exitRealtime() noexcept {}
+    inline void enterAllow() noexcept {}
+    inline void exitAllow() noexcept {}
+#endif
+
+    struct ScopedRealtime
+    {
+        ScopedRealtime() noexcept { enterRealtime(); }
+        ~ScopedRealtime() noexcept { exitRealtime(); }
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedRealtime)
+    };
+
+    struct ScopedAllow
+    {
+        ScopedAllow() noexcept { enterAllow(); }
+        ~ScopedAllow() noexcept { exitAllow(); }
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedAllow)
+    };
+}
@@ -0,0 +1,60 @@
+// AnalysisPool.cpp
+
+#include "AnalysisPool.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#elif JUCE_MAC || JUCE_IOS
+ #include <dispatch/dispatch.h>
+#else
+ #include <cerrno>
+ #include <semaphore.h>
+#endif
+
+AnalysisPool::Semaphore::Semaphore()
+{
+   #if JUCE_WINDOWS
+    handle = CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr);
+   #elif JUCE_MAC || JUCE_IOS
+    handle = dispatch_semaphore_create(0);
+   #else
+    auto* semaphore = new sem_t;
+    sem_init(semaphore, 0, 0);
+    handle = semaphore;
+   #endif
+    jassert(handle != nullptr);
+}
+
+AnalysisPool::Semaphore::~Semaphore()
+{
+   #if JUCE_WINDOWS
+    CloseHandle(handle);
+   #elif JUCE_MAC || JUCE_IOS
+    dispatch_release(static_cast<dispatch_semaphore_t>(handle));
+   #else
+    sem_destroy(static_cast<sem_t*>(handle));
+    delete static_cast<sem_t*>(handle);
+   #endif
+}
+
+void AnalysisPool::Semaphore::signal() noexcept
+{
+   #if JUCE_WINDOWS
+    ReleaseSemaphore(handle, 1, nullptr);
+   #elif JUCE_MAC || JUCE_IOS
+    dispatch_semaphore_signal(static_cast<dispatch_semaphore_t>(handle));
+   #else
+    sem_post(static_cast<sem_t*>(handle));
+   #endif
+}
+
+void AnalysisPool::Semaphore::wait() noexcept
+{
+   #if JUCE_WINDOWS
+    WaitForSingleObject(handle, INFINITE);
+   #elif JUCE_MAC || JUCE_IOS
+    dispatch_semaphore_wait(static_cast<dispatch_semaphore_t>(handle), DISPATCH_TIME_FOREVER);
+   #else
+    while (sem_wait(static_cast<sem_t*>(handle)) != 0 && errno == EINTR) {}
+   #endif
+}
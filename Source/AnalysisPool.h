@@ -0,0 +1,206 @@
+// AnalysisPool.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// One set of analysis threads for every plugin instance in the process, sized to the machine rather than the
+// session. Instances register a Client while they're playing and wake the pool whenever they queue work, which
+// posts a parked thread's semaphore without taking any lock. A woken thread claims the next client with work
+// waiting, wakes another idle thread in case there are more, and runs the client with no lock held, so a busy
+// instance is picked up by whichever thread gets there first and never runs on two at once. Clients talk to
+// their audio thread through their own lock-free queues; all the audio thread does with the pool is wake it.
+// Share it with juce::SharedResourcePointer<AnalysisPool>: created with the first instance, gone with the last.
+class AnalysisPool
+{
+public:
+    class Client
+    {
+    public:
+        virtual ~Client() = default;
+
+        // Pool thread, claimed. Does whatever work is waiting and returns true if there was any.
+        virtual bool runAnalysis() = 0;
+
+        // Any thread. True if runAnalysis() has something to do.
+        virtual bool hasWork() const noexcept = 0;
+
+        // Any thread, lock-free: true between add() and remove().
+        bool isRegistered() const noexcept { return registered.load(std::memory_order_acquire); }
+
+        // Pool thread: remove() is waiting for this client, so runAnalysis() should return at the next safe point.
+        bool shouldStop() const noexcept { return stopping.load(std::memory_order_acquire); }
+
+    private:
+        friend class AnalysisPool;
+        std::atomic<bool> registered{ false };
+        std::atomic<bool> claimed{ false };
+        std::atomic<bool> stopping{ false };
+    };
+
+    AnalysisPool()
+    {
+        const int numThreads = juce::jlimit(1, maxThreads, juce::SystemStats::getNumCpus() / 2);
+        for (int i = 0; i < numThreads; ++i)
+        {
+            workers.add(new Worker(*this, i));
+        }
+        for (auto* worker : workers)
+        {
+            worker->startThread();
+        }
+    }
+
+    ~AnalysisPool()
+    {
+        for (auto* worker : workers)
+        {
+            worker->signalThreadShouldExit();
+            worker->wakeUp.signal();
+        }
+        for (auto* worker : workers)
+        {
+            worker->stopThread(1000);
+        }
+    }
+
+    // Message thread. Starts running the client's work on the pool.
+    void add(Client& client)
+    {
+        {
+            const juce::ScopedWriteLock lock(clientsLock);
+            if (!clients.contains(&client))
+            {
+                clients.add(&client);
+            }
+            client.registered.store(true, std::memory_order_release);
+        }
+        wake();
+    }
+
+    // Message thread. Returns once no pool thread is running the client, or will again until it's re-added.
+    // A job already running is asked to stop, so this waits for one step of it at most, never a whole job.
+    void remove(Client& client)
+    {
+        {
+            const juce::ScopedWriteLock lock(clientsLock);
+            clients.removeFirstMatchingValue(&client);
+            client.registered.store(false, std::memory_order_release);
+        }
+
+        // Clients are only claimed under the read lock, so nobody can claim it from here on
+        client.stopping.store(true, std::memory_order_release);
+        while (client.claimed.load(std::memory_order_acquire))
+        {
+            juce::Thread::yield();
+        }
+        client.stopping.store(false, std::memory_order_release);
+    }
+
+    // Any thread, including the audio thread: there's new work for some client. Lock-free; wakes a parked
+    // worker if there is one. If they're all busy nobody needs waking, as each looks for work before parking.
+    void wake() noexcept
+    {
+        const int numWorkers = workers.size();
+        const auto first = static_cast<int>(nextToWake.fetch_add(1, std::memory_order_relaxed) % static_cast<unsigned int>(numWorkers));
+        for (int i = 0; i < numWorkers; ++i)
+        {
+            auto* worker = workers.getUnchecked((first + i) % numWorkers);
+            if (worker->parked.load() && worker->parked.exchange(false))
+            {
+                worker->wakeUp.signal();
+                return;
+            }
+        }
+    }
+
+    int getNumThreads() const noexcept { return workers.size(); }
+
+private:
+    static constexpr int maxThreads = 8;
+
+    // Counting semaphore whose signal() takes no lock, so the audio thread can post it: a kernel semaphore on
+    // Windows, a dispatch semaphore on macOS and a POSIX one elsewhere (see AnalysisPool.cpp).
+    class Semaphore
+    {
+    public:
+        Semaphore();
+        ~Semaphore();
+
+        void signal() noexcept;
+        void wait() noexcept;
+
+    private:
+        void* handle = nullptr;
+
+        JUCE_DECLARE_NON_COPYABLE(Semaphore)
+    };
+
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(AnalysisPool& p, int i) : juce::Thread("CounterTune analysis " + juce::String(i + 1)), pool(p) {}
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                auto* client = pool.claimNext(cursor);
+                if (client == nullptr)
+                {
+                    // Park, then look once more: work queued since the search either turns up now or finds us
+                    // parked and wakes us. (parked and the client queues are sequentially consistent atomics.)
+                    parked.store(true);
+                    client = pool.claimNext(cursor);
+                    if (client == nullptr)
+                    {
+                        wakeUp.wait(); // until wake() or the destructor; a stale signal just means one more look
+                        continue;
+                    }
+                    parked.store(false);
+                }
+
+                client->runAnalysis();
+                client->claimed.store(false, std::memory_order_release);
+            }
+        }
+
+        Semaphore wakeUp;
+        std::atomic<bool> parked{ false };
+
+    private:
+        AnalysisPool& pool;
+        int cursor = 0; // where the next search for work starts, so every client gets its turn
+    };
+
+    // Claims the first client after the cursor with work waiting and no thread running it, or returns nullptr.
+    Client* claimNext(int& cursor)
+    {
+        const juce::ScopedReadLock lock(clientsLock);
+        const int numClients = clients.size();
+
+        for (int i = 0; i < numClients; ++i)
+        {
+            auto* client = clients.getUnchecked((cursor + i) % numClients);
+            if (!client->hasWork() || client->claimed.exchange(true, std::memory_order_acquire))
+            {
+                continue; // nothing to do, or another thread has it
+            }
+
+            cursor = (cursor + i + 1) % numClients;
+            if (numClients > 1)
+            {
+                wake(); // an idle thread can take the next client meanwhile
+            }
+            return client;
+        }
+        return nullptr;
+    }
+
+    juce::ReadWriteLock clientsLock;
+    juce::Array<Client*> clients;
+    juce::OwnedArray<Worker> workers;
+    std::atomic<unsigned int> nextToWake{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(AnalysisPool)
+};
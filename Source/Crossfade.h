@@ -0,0 +1,70 @@
+// Crossfade.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Equal-power crossfade for splicing tiles. fadeIn(x) = sin(x * pi/2) and fadeOut(x) = fadeIn(1 - x), so
+// fadeIn^2 + fadeOut^2 = 1 and uncorrelated material keeps its level through the seam, where a linear
+// fade dips by 3 dB in the middle. The curve is tabulated once and stretched to whatever overlap length
+// is asked for; the blend itself is vector ops over a stack-sized chunk of gains.
+class EqualPowerCrossfade
+{
+public:
+    static constexpr int tableSize = 1024;
+
+    EqualPowerCrossfade()
+    {
+        for (int i = 0; i <= tableSize; ++i)
+            table[static_cast<size_t>(i)] = std::sin(static_cast<float>(i) / tableSize * juce::MathConstants<float>::halfPi);
+    }
+
+    // Blends incoming into dest: dest = dest * fadeOut + incoming * fadeIn, for positions
+    // [position, position + numSamples) of an overlap totalSamples long. A long overlap can be
+    // blended in several calls (e.g. around a ring-buffer wrap) by advancing position.
+    void apply(float* const* dest, const float* const* incoming, int numChannels,
+               int numSamples, int position, int totalSamples) const noexcept
+    {
+        float fadeIn[chunkSize];
+        float fadeOut[chunkSize];
+
+        for (int done = 0; done < numSamples;)
+        {
+            const int chunk = juce::jmin(chunkSize, numSamples - done);
+            fillGains(fadeIn, fadeOut, chunk, position + done, totalSamples);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                juce::FloatVectorOperations::multiply(dest[ch] + done, fadeOut, chunk);
+                juce::FloatVectorOperations::addWithMultiply(dest[ch] + done, incoming[ch] + done, fadeIn, chunk);
+            }
+
+            done += chunk;
+        }
+    }
+
+    // Gains for positions [position, position + numSamples) of an overlap totalSamples long.
+    void fillGains(float* fadeIn, float* fadeOut, int numSamples, int position, int totalSamples) const noexcept
+    {
+        const float scale = totalSamples > 0 ? static_cast<float>(tableSize) / static_cast<float>(totalSamples) : 0.0f;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float x = juce::jlimit(0.0f, static_cast<float>(tableSize), static_cast<float>(position + i) * scale);
+            fadeIn[i] = lookup(x);
+            fadeOut[i] = lookup(tableSize - x);
+        }
+    }
+
+private:
+    static constexpr int chunkSize = 256;
+
+    float lookup(float x) const noexcept
+    {
+        const int index = juce::jmin(static_cast<int>(x), tableSize - 1);
+        const float frac = x - static_cast<float>(index);
+        return table[static_cast<size_t>(index)] + frac * (table[static_cast<size_t>(index + 1)] - table[static_cast<size_t>(index)]);
+    }
+
+    std::array<float, tableSize + 1> table;
+};
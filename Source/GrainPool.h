@@ -0,0 +1,286 @@
+// GrainPool.h
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Resampler.h"
+#include "Crossfade.h"
+
+// Fixed pool of overlapping grains summed straight into the output block. A grain reads its source at a
+// rate (1 for an already pitched tile, which is mixed without resampling) under an equal-power fade-in
+// and fade-out window. Starting, fading and stopping grains only touches the pool's own slots, so any
+// number of overlaps up to maxGrains costs nothing beyond mixing them. Grains are tagged with the harmony
+// voice that started them, so each voice can fade out its own line without touching the others.
+//
+// Grain state is kept one array per field, and the per-block bookkeeping (how far each grain plays, and
+// moving it on) runs across all the slots at once in SIMD registers; only the mixing is done grain by grain.
+class GrainPool
+{
+public:
+    static constexpr int maxGrains = 32; // eight voices crossfading two grains each, with room to spare
+
+    GrainPool() = default;
+
+    // Starts a grain and returns its slot. If every slot is busy the grain closest to its end is replaced.
+    int start(const Resampler::SourceView& source, const void* owner, double rate, int length, int fadeInLength,
+              float gain = 1.0f, int voice = 0) noexcept
+    {
+        int slot = 0;
+        for (int i = 0; i < maxGrains; ++i)
+        {
+            if (!isActive(i)) { slot = i; break; }
+            if (getRemaining(i) < getRemaining(slot)) slot = i;
+        }
+
+        const auto i = static_cast<size_t>(slot);
+        sources[i] = source;
+        owners[i] = owner;
+        rates[i] = rate;
+        lengths[i] = length;
+        positions[i] = 0;
+        ends[i] = juce::jmax(0, length);
+        fadeInLengths[i] = fadeInLength;
+        fadeOutStarts[i] = std::numeric_limits<int>::max();
+        fadeOutLengths[i] = 0;
+        gains[i] = gain;
+        voices[i] = voice;
+        return slot;
+    }
+
+    // Fades every playing grain out over the next fadeLength samples (or what it has left, if less),
+    // unless it's already on its way out sooner. A fade of no length stops the grain.
+    void fadeOutAll(int fadeLength) noexcept
+    {
+        for (int i = 0; i < maxGrains; ++i)
+        {
+            if (isActive(i)) fadeOut(i, fadeLength);
+        }
+    }
+
+    // As fadeOutAll(), for one voice's grains only.
+    void fadeOutVoice(int voice, int fadeLength) noexcept
+    {
+        for (int i = 0; i < maxGrains; ++i)
+        {
+            if (isActive(i) && voices[static_cast<size_t>(i)] == voice) fadeOut(i, fadeLength);
+        }
+    }
+
+    // Hands a voice over to the grain in incomingSlot: it fades in over crossfadeLength samples while the voice's
+    // other grains fade out over the same samples on the complementary curve, so the level holds through it.
+    void crossfadeVoice(int voice, int incomingSlot, int crossfadeLength) noexcept
+    {
+        for (int i = 0; i < maxGrains; ++i)
+        {
+            if (i != incomingSlot && isActive(i) && voices[static_cast<size_t>(i)] == voice) fadeOut(i, crossfadeLength);
+        }
+        fadeInLengths[static_cast<size_t>(incomingSlot)] = crossfadeLength;
+    }
+
+    void stopAll() noexcept
+    {
+        ends = positions;
+    }
+
+    void stopUsing(const void* owner) noexcept
+    {
+        for (size_t i = 0; i < maxGrains; ++i)
+            if (owners[i] == owner) ends[i] = positions[i];
+    }
+
+    bool isUsing(const void* owner) const noexcept
+    {
+        for (int i = 0; i < maxGrains; ++i)
+            if (isActive(i) && owners[static_cast<size_t>(i)] == owner) return true;
+        return false;
+    }
+
+    int getNumActive() const noexcept
+    {
+        int count = 0;
+        for (int i = 0; i < maxGrains; ++i)
+            if (isActive(i)) ++count;
+        return count;
+    }
+
+    bool isActive(int slot) const noexcept { return positions[static_cast<size_t>(slot)] < ends[static_cast<size_t>(slot)]; }
+    int getVoice(int slot) const noexcept { return voices[static_cast<size_t>(slot)]; }
+    int getLength(int slot) const noexcept { return lengths[static_cast<size_t>(slot)]; }
+
+    // Output samples until the grain's natural end, ignoring any fade-out; 0 once it has stopped.
+    int getRemaining(int slot) const noexcept
+    {
+        return isActive(slot) ? lengths[static_cast<size_t>(slot)] - positions[static_cast<size_t>(slot)] : 0;
+    }
+
+    // Adds every grain into dest[0 .. numSamples) and moves them on.
+    // dest has NumChannels (1 or 2) channels; a mono source plays on both of a stereo output.
+    template <int NumChannels>
+    void process(const ResamplingEngine& engine, ResamplingEngine::Quality quality, const EqualPowerCrossfade& crossfade,
+                 float* const* dest, int numSamples) noexcept
+    {
+        static_assert(NumChannels == 1 || NumChannels == 2, "grains play to mono or stereo");
+
+        // How much of the block each grain plays: up to its end or the end of its fade-out, none once stopped
+       #if JUCE_USE_SIMD
+        const auto blockLength = Lanes::expand(numSamples);
+        const auto none = Lanes::expand(0);
+        for (size_t i = 0; i < maxGrains; i += Lanes::SIMDNumElements)
+        {
+            const auto untilEnd = Lanes::fromRawArray(ends.data() + i) - Lanes::fromRawArray(positions.data() + i);
+            Lanes::max(none, Lanes::min(blockLength, untilEnd)).copyToRawArray(toPlay.data() + i);
+        }
+       #else
+        for (size_t i = 0; i < maxGrains; ++i)
+            toPlay[i] = juce::jlimit(0, numSamples, ends[i] - positions[i]);
+       #endif
+
+        for (int i = 0; i < maxGrains; ++i)
+        {
+            if (toPlay[static_cast<size_t>(i)] > 0)
+                processGrain<NumChannels>(i, engine, quality, crossfade, dest);
+        }
+
+        // Then every grain moves on at once; one that reached its end stops with it
+       #if JUCE_USE_SIMD
+        for (size_t i = 0; i < maxGrains; i += Lanes::SIMDNumElements)
+            (Lanes::fromRawArray(positions.data() + i) + Lanes::fromRawArray(toPlay.data() + i)).copyToRawArray(positions.data() + i);
+       #else
+        for (size_t i = 0; i < maxGrains; ++i)
+            positions[i] += toPlay[i];
+       #endif
+    }
+
+private:
+    static constexpr int chunkSize = 256;
+
+   #if JUCE_USE_SIMD
+    using Lanes = juce::dsp::SIMDRegister<int>;
+    static constexpr size_t laneAlignment = Lanes::SIMDRegisterSize;
+    static_assert(maxGrains % Lanes::SIMDNumElements == 0, "slots fill whole registers");
+   #else
+    static constexpr size_t laneAlignment = alignof(int);
+   #endif
+
+    void fadeOut(int slot, int fadeLength) noexcept
+    {
+        const auto i = static_cast<size_t>(slot);
+        const int fade = juce::jmin(fadeLength, getRemaining(slot));
+        if (fade <= 0)
+        {
+            ends[i] = positions[i]; // a zero-length window would otherwise leave it at full gain
+            return;
+        }
+        if (positions[i] + fade < fadeOutStarts[i] + fadeOutLengths[i])
+        {
+            fadeOutStarts[i] = positions[i];
+            fadeOutLengths[i] = fade;
+            ends[i] = positions[i] + fade; // past it is silence
+        }
+    }
+
+    // Mixes toPlay[slot] samples of one grain from its current position; process() moves it on after.
+    template <int NumChannels>
+    void processGrain(int slot, const ResamplingEngine& engine, ResamplingEngine::Quality quality, const EqualPowerCrossfade& crossfade,
+                      float* const* dest) noexcept
+    {
+        const auto g = static_cast<size_t>(slot);
+        const auto& source = sources[g];
+        const double rate = rates[g];
+        const float gain = gains[g];
+        const int start = positions[g];
+        const int fadeInLength = fadeInLengths[g];
+        const int fadeOutStart = fadeOutStarts[g];
+        const int fadeOutLength = fadeOutLengths[g];
+
+        // Only the channels the source has are read or resampled; the rest of the output repeats the first
+        const int sourceChannels = juce::jlimit(1, NumChannels, source.numChannels);
+        float rendered[NumChannels][chunkSize];
+        float* renderedChannels[NumChannels];
+        for (int ch = 0; ch < NumChannels; ++ch)
+            renderedChannels[ch] = rendered[ch];
+        const Resampler::DestinationView renderView{ renderedChannels, sourceChannels, chunkSize };
+        float windowGains[chunkSize], fadeIn[chunkSize], fadeOut[chunkSize];
+
+        // Grains start at the top of their source, so the read phase is the position times the rate. A
+        // pre-pitched tile is mixed straight from the source.
+        const bool direct = rate == 1.0;
+        const int numToPlay = toPlay[g];
+
+        for (int done = 0; done < numToPlay;)
+        {
+            const int n = juce::jmin(chunkSize, numToPlay - done);
+            const int position = start + done;
+
+            const float* channels[NumChannels] = {};
+            if (direct)
+            {
+                const int available = juce::jlimit(0, n, source.numSamples - position);
+                for (int ch = 0; ch < sourceChannels; ++ch)
+                {
+                    if (available == n)
+                    {
+                        channels[ch] = source.channels[ch] + position;
+                        continue;
+                    }
+
+                    // Past the end of the source is silence, same as a resampled read
+                    juce::FloatVectorOperations::copy(rendered[ch], source.channels[ch] + position, available);
+                    juce::FloatVectorOperations::clear(rendered[ch] + available, n - available);
+                    channels[ch] = rendered[ch];
+                }
+            }
+            else
+            {
+                engine.render(quality, source, renderView, 0, n, rate, position * rate);
+                for (int ch = 0; ch < sourceChannels; ++ch)
+                    channels[ch] = rendered[ch];
+            }
+            for (int ch = sourceChannels; ch < NumChannels; ++ch)
+                channels[ch] = channels[0];
+
+            // Window: fade in from the start, fade out from fadeOutStart, times the grain gain
+            bool unity = gain == 1.0f;
+            juce::FloatVectorOperations::fill(windowGains, gain, n);
+            if (position < fadeInLength)
+            {
+                crossfade.fillGains(fadeIn, fadeOut, n, position, fadeInLength);
+                juce::FloatVectorOperations::multiply(windowGains, fadeIn, n);
+                unity = false;
+            }
+            if (position + n > fadeOutStart)
+            {
+                crossfade.fillGains(fadeIn, fadeOut, n, position - fadeOutStart, fadeOutLength);
+                juce::FloatVectorOperations::multiply(windowGains, fadeOut, n);
+                unity = false;
+            }
+
+            for (int ch = 0; ch < NumChannels; ++ch)
+            {
+                if (unity)
+                    juce::FloatVectorOperations::add(dest[ch] + done, channels[ch], n);
+                else
+                    juce::FloatVectorOperations::addWithMultiply(dest[ch] + done, channels[ch], windowGains, n);
+            }
+
+            done += n;
+        }
+    }
+
+    // One entry per slot. A grain is playing while its position is short of its end, which is its length or
+    // the end of its fade-out, whichever comes first; stopping it sets its end to where it is.
+    std::array<Resampler::SourceView, maxGrains> sources{};
+    std::array<const void*, maxGrains> owners{}; // the buffer each source lives in, so it isn't reused while we read it
+    std::array<double, maxGrains> rates{};
+    std::array<float, maxGrains> gains{};
+    std::array<int, maxGrains> voices{};
+    std::array<int, maxGrains> lengths{};        // output samples
+    alignas(laneAlignment) std::array<int, maxGrains> positions{}; // output samples played so far
+    alignas(laneAlignment) std::array<int, maxGrains> ends{};
+    alignas(laneAlignment) std::array<int, maxGrains> toPlay{};    // this block
+    std::array<int, maxGrains> fadeInLengths{};
+    std::array<int, maxGrains> fadeOutStarts{};
+    std::array<int, maxGrains> fadeOutLengths{};
+
+    JUCE_DECLARE_NON_COPYABLE(GrainPool)
+};
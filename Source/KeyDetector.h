@@ -0,0 +1,141 @@
+// KeyDetector.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Guesses the key of the input from the notes the pitch tracker finds. Every analysis frame adds its note to a
+// 12-bin pitch-class histogram that forgets old notes exponentially. Rather than decaying all twelve bins each
+// frame, the weight given to new notes grows instead, and the bins are scaled back down only when that weight
+// gets large, so a frame costs one multiply and one add. Keys are only scored when asked, at the end of a
+// cycle: the histogram's correlation with the Krumhansl-Kessler major and minor profiles in all 12 transpositions.
+// Keys are numbered 0-11 for C to B major and 12-23 for C to B minor.
+class KeyDetector
+{
+public:
+    static constexpr int noKey = -1;
+    static constexpr int numKeys = 24;
+
+    static int tonicOf(int key) noexcept { return key % 12; }
+    static bool isMinor(int key) noexcept { return key >= 12; }
+
+    KeyDetector()
+    {
+        // Centred and unit length, so a dot product with a histogram is its correlation up to one common factor
+        constexpr float majorProfile[12] = { 6.35f, 2.23f, 3.48f, 2.33f, 4.38f, 4.09f, 2.52f, 5.19f, 2.39f, 3.66f, 2.29f, 2.88f };
+        constexpr float minorProfile[12] = { 6.33f, 2.68f, 3.52f, 5.38f, 2.60f, 3.53f, 2.54f, 4.75f, 3.98f, 2.69f, 3.34f, 3.17f };
+        centreAndNormalise(majorProfile, profiles[0]);
+        centreAndNormalise(minorProfile, profiles[1]);
+    }
+
+    // Message thread, before any frames: notes fade to a third of their weight over memorySeconds.
+    void prepare(double framesPerSecond, double memorySeconds = 30.0)
+    {
+        growth = static_cast<float>(std::exp(1.0 / juce::jmax(1.0, framesPerSecond * memorySeconds)));
+        minFrames = static_cast<float>(framesPerSecond * minVoicedSeconds);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        histogram.fill(0.0f);
+        total = 0.0f;
+        weight = 1.0f;
+        currentKey = noKey;
+    }
+
+    // One per analysis frame; noteNumber is -1 for an unvoiced frame, which still ages the histogram.
+    void addFrame(int noteNumber) noexcept
+    {
+        weight *= growth;
+        if (noteNumber >= 0)
+        {
+            histogram[static_cast<size_t>(noteNumber % 12)] += weight;
+            total += weight;
+        }
+
+        if (weight > rescaleAbove)
+        {
+            for (auto& bin : histogram)
+            {
+                bin /= weight;
+            }
+            total /= weight;
+            weight = 1.0f;
+        }
+    }
+
+    // Scores all 24 keys and returns the best, or noKey until enough notes have been heard or if none fits.
+    // The previous answer is kept unless another key beats it by a margin, so close calls don't flip-flop.
+    int detect() noexcept
+    {
+        if (total / weight < minFrames)
+        {
+            return currentKey = noKey;
+        }
+
+        const float mean = total / 12.0f;
+        float spread = 0.0f;
+        for (const float bin : histogram)
+        {
+            spread += (bin - mean) * (bin - mean);
+        }
+        if (spread <= 0.0f)
+        {
+            return currentKey = noKey; // every pitch class equally: no key
+        }
+
+        std::array<float, numKeys> scores{};
+        for (int key = 0; key < numKeys; ++key)
+        {
+            const auto& profile = profiles[isMinor(key) ? 1 : 0];
+            const int tonic = tonicOf(key);
+            float dot = 0.0f;
+            for (int pitchClass = 0; pitchClass < 12; ++pitchClass)
+            {
+                dot += histogram[static_cast<size_t>(pitchClass)] * profile[static_cast<size_t>((pitchClass - tonic + 12) % 12)];
+            }
+            scores[static_cast<size_t>(key)] = dot / std::sqrt(spread);
+        }
+
+        const int best = static_cast<int>(std::max_element(scores.begin(), scores.end()) - scores.begin());
+        if (scores[static_cast<size_t>(best)] < minCorrelation)
+        {
+            return currentKey = noKey;
+        }
+        if (currentKey == noKey || scores[static_cast<size_t>(best)] > scores[static_cast<size_t>(currentKey)] + switchMargin)
+        {
+            currentKey = best;
+        }
+        return currentKey;
+    }
+
+private:
+    static constexpr float rescaleAbove = 1.0e15f;
+    static constexpr double minVoicedSeconds = 2.0;
+    static constexpr float minCorrelation = 0.5f;
+    static constexpr float switchMargin = 0.05f;
+
+    static void centreAndNormalise(const float (&profile)[12], std::array<float, 12>& result)
+    {
+        const float mean = std::accumulate(std::begin(profile), std::end(profile), 0.0f) / 12.0f;
+        float length = 0.0f;
+        for (size_t i = 0; i < 12; ++i)
+        {
+            result[i] = profile[i] - mean;
+            length += result[i] * result[i];
+        }
+        for (auto& value : result)
+        {
+            value /= std::sqrt(length);
+        }
+    }
+
+    std::array<std::array<float, 12>, 2> profiles{};
+    std::array<float, 12> histogram{};
+    float total = 0.0f;
+    float weight = 1.0f;
+    float growth = 1.0f;
+    float minFrames = 1.0f;
+    int currentKey = noKey;
+};
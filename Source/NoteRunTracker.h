@@ -0,0 +1,72 @@
+// NoteRunTracker.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Follows the detected note frame by frame and remembers the first one held for longer than minRunFrames
+// analysis windows, so the voice to extract is known the moment a cycle ends. Frames overlap by the hop, so
+// a run is measured in time from the frame timestamps rather than by counting frames. Each frame is constant
+// work on a few fixed fields: nothing grows with the cycle, so nothing is scanned, erased or reallocated.
+class NoteRunTracker
+{
+public:
+    static constexpr int minRunFrames = 5;
+
+    struct Run
+    {
+        int noteNumber = -1;
+        juce::int64 firstSample = -1; // first sample of the run's first frame
+
+        bool isValid() const noexcept { return firstSample >= 0; }
+    };
+
+    NoteRunTracker() = default;
+
+    // Forgets the last cycle. dropFirstFrame skips the next frame, the duplicate that starts a triggered run.
+    void startCycle(int newFrameSize, bool dropFirstFrame = false) noexcept
+    {
+        frameSize = newFrameSize;
+        dropNextFrame = dropFirstFrame;
+        numFrames = 0;
+        anyVoiced = false;
+        current = {};
+        firstLongRun = {};
+    }
+
+    void addFrame(int noteNumber, bool voiced, juce::int64 frameStartSample) noexcept
+    {
+        if (dropNextFrame)
+        {
+            dropNextFrame = false;
+            return;
+        }
+
+        ++numFrames;
+        anyVoiced = anyVoiced || voiced;
+        if (firstLongRun.isValid())
+            return;
+
+        if (numFrames == 1 || noteNumber != current.noteNumber)
+            current = { noteNumber, frameStartSample };
+
+        if (frameStartSample + frameSize - current.firstSample > static_cast<juce::int64>(minRunFrames) * frameSize)
+            firstLongRun = current;
+    }
+
+    // The first run longer than minRunFrames windows this cycle, or an invalid Run if there wasn't one.
+    Run getFirstLongRun() const noexcept { return firstLongRun; }
+
+    int getNumFrames() const noexcept { return numFrames; }
+
+    // True if the cycle had frames and none of them found a pitch.
+    bool wasSilent() const noexcept { return numFrames > 0 && !anyVoiced; }
+
+private:
+    int frameSize = 0;
+    bool dropNextFrame = false;
+    int numFrames = 0;
+    bool anyVoiced = false;
+    Run current;
+    Run firstLongRun;
+};
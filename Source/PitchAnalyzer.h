@@ -0,0 +1,98 @@
+// PitchAnalyzer.h
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "dywapitchtrack.h"
+
+// Sliding-window pitch tracker. The last frameSize samples live in a mirrored ring (every sample is
+// written twice, frameSize apart) so the current window is always contiguous, and dywapitchtrack runs
+// on it every hopSize samples. Each result is reported with the absolute sample position of the
+// window's first sample.
+class PitchAnalyzer
+{
+public:
+    PitchAnalyzer() { dywapitch_inittracking(&tracker); }
+
+    // Message thread only. The tracker's pitch history is kept across calls.
+    void prepare(double newSampleRate, int newFrameSize, int newHopSize)
+    {
+        sampleRate = newSampleRate;
+        frameSize = newFrameSize;
+        hopSize = juce::jlimit(1, frameSize, newHopSize);
+
+        ring.allocate(static_cast<size_t>(2 * frameSize), true);
+        workspaceMemory.malloc(static_cast<size_t>(dywapitch_neededworkspace(frameSize)));
+        dywapitch_initworkspace(&workspace, workspaceMemory.get(), frameSize);
+
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        writePos = 0;
+        numFilled = 0;
+        samplesUntilHop = hopSize;
+    }
+
+    int getFrameSize() const noexcept { return frameSize; }
+    int getHopSize() const noexcept { return hopSize; }
+
+    // Feeds a block whose first sample sits at blockStartSample on the caller's clock.
+    // Calls onFrame(double pitchHz, juce::int64 frameStartSample) for every hop completed in the block.
+    template <typename Callback>
+    void process(const float* input, int numSamples, juce::int64 blockStartSample, Callback&& onFrame)
+    {
+        int consumed = 0;
+        while (consumed < numSamples)
+        {
+            const int chunk = juce::jmin(numSamples - consumed, samplesUntilHop);
+            write(input + consumed, chunk);
+            consumed += chunk;
+            samplesUntilHop -= chunk;
+
+            if (samplesUntilHop == 0)
+            {
+                samplesUntilHop = hopSize;
+
+                if (numFilled >= frameSize)
+                {
+                    // Oldest sample is at writePos; the mirror makes the next frameSize samples contiguous
+                    double pitch = dywapitch_computepitchf(&tracker, &workspace, ring.get() + writePos, 0, frameSize, sampleRate);
+                    onFrame(pitch, blockStartSample + consumed - frameSize);
+                }
+            }
+        }
+    }
+
+private:
+    void write(const float* input, int numSamples) noexcept
+    {
+        numFilled = juce::jmin(frameSize, numFilled + numSamples);
+
+        while (numSamples > 0)
+        {
+            const int contiguous = juce::jmin(numSamples, frameSize - writePos);
+            juce::FloatVectorOperations::copy(ring.get() + writePos, input, contiguous);
+            juce::FloatVectorOperations::copy(ring.get() + writePos + frameSize, input, contiguous);
+
+            writePos = (writePos + contiguous) % frameSize;
+            input += contiguous;
+            numSamples -= contiguous;
+        }
+    }
+
+    dywapitchtracker tracker;
+    dywapitchworkspace workspace{};
+    juce::HeapBlock<char> workspaceMemory;
+    juce::HeapBlock<float> ring;
+
+    double sampleRate = 44100.0;
+    int frameSize = 0;
+    int hopSize = 1;
+    int writePos = 0;
+    int numFilled = 0;
+    int samplesUntilHop = 1;
+
+    JUCE_DECLARE_NON_COPYABLE(PitchAnalyzer)
+};
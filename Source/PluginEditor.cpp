@@ -37,11 +37,42 @@ void CounterTune_v2AudioProcessorEditor::timerCallback()
         firstLoad = false;
     }
 
-    waveform.setAudioBuffer(&audioProcessor.uiWaveform, audioProcessor.uiWaveform.getNumSamples());
+    // Auto key never touches the parameters, so the labels follow what's actually playing instead
+    if (audioProcessor.getMelodyKey() != shownKey && !keyValueLabel.hasKeyboardFocus(true)) updateKeyValueLabel();
+    if (audioProcessor.getMelodyScale() != shownScale && !scaleValueLabel.hasKeyboardFocus(true)) updateScaleValueLabel();
+    if (audioProcessor.getNumScales() != shownNumScales) updateScaleRange(); // a session restore brings its own user scales
+
+    // The viewer keeps pointing at the processor's read slot, which only changes on this thread
+    audioProcessor.pullUiWaveform();
+    waveform.setAudioBuffer(&audioProcessor.getUiWaveform(), audioProcessor.getUiWaveform().getNumSamples());
     bool isFlat = waveform.isFlat();
     waveform.setVisible(!isFlat);
     waveform.repaint();
 
+   #if COUNTERTUNE_PROFILING
+    if (showStageTimings) repaint();
+   #endif
+}
+
+void CounterTune_v2AudioProcessorEditor::chooseUserScales()
+{
+    // One "<name> = <semitones above the root>" per line; they follow the built-in scales on the knob
+    scalesChooser = std::make_unique<juce::FileChooser>("Load user scales", juce::File::getSpecialLocation(juce::File::userDocumentsDirectory), "*.txt");
+    scalesChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles, [this](const juce::FileChooser& chooser)
+    {
+        const auto file = chooser.getResult();
+        if (file == juce::File())
+        {
+            return; // cancelled
+        }
+
+        const auto error = audioProcessor.loadUserScales(file);
+        if (error.isNotEmpty())
+        {
+            juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon, "Couldn't load " + file.getFileName(), error);
+        }
+        updateScaleRange();
+    });
 }
 
 void CounterTune_v2AudioProcessorEditor::paint (juce::Graphics& g)
@@ -54,6 +85,58 @@ void CounterTune_v2AudioProcessorEditor::resized()
 
 }
 
+#if COUNTERTUNE_PROFILING
+bool CounterTune_v2AudioProcessorEditor::keyPressed(const juce::KeyPress& key)
+{
+    const juce::ModifierKeys modifiers(juce::ModifierKeys::commandModifier | juce::ModifierKeys::shiftModifier);
+    auto& profiler = audioProcessor.getStageProfiler();
+
+    if (key == juce::KeyPress('t', modifiers, 0))
+    {
+        showStageTimings = !showStageTimings;
+        repaint();
+        return true;
+    }
+    if (key == juce::KeyPress('r', modifiers, 0))
+    {
+        profiler.reset();
+        return true;
+    }
+    if (key == juce::KeyPress('d', modifiers, 0))
+    {
+        profiler.dumpToFile(juce::File::getSpecialLocation(juce::File::userDocumentsDirectory).getChildFile("CounterTune_stage_timings.json"));
+        return true;
+    }
+    return false;
+}
+
+void CounterTune_v2AudioProcessorEditor::paintOverChildren(juce::Graphics& g)
+{
+    if (!showStageTimings) return;
+
+    // One line per stage: mean / p99 / max time as a percentage of the block's real-time budget
+    auto& profiler = audioProcessor.getStageProfiler();
+    auto area = juce::Rectangle<int>(8, 8, 330, 18 * (StageProfiler::numStages + 1) + 8);
+    g.setColour(backgroundColor.withAlpha(0.8f));
+    g.fillRect(area);
+    g.setColour(foregroundColor);
+    g.setFont(getCustomFont(13.0f));
+
+    area.reduce(6, 4);
+    g.drawText(juce::String("STAGE %").paddedRight(' ', 16) + juce::String("MEAN").paddedLeft(' ', 5) + juce::String("P99").paddedLeft(' ', 7) + juce::String("MAX").paddedLeft(' ', 7),
+               area.removeFromTop(18), juce::Justification::centredLeft);
+    for (int stage = 0; stage < StageProfiler::numStages; ++stage)
+    {
+        const auto summary = profiler.getSummary(stage);
+        const auto text = juce::String(StageProfiler::getStageName(stage)).toUpperCase().paddedRight(' ', 16)
+                        + juce::String(summary.meanPercent, 1).paddedLeft(' ', 5)
+                        + juce::String(summary.p99Percent, 1).paddedLeft(' ', 7)
+                        + juce::String(summary.maxPercent, 1).paddedLeft(' ', 7);
+        g.drawText(text, area.removeFromTop(18), juce::Justification::centredLeft);
+    }
+}
+#endif
+
 void CounterTune_v2AudioProcessorEditor::setupParams()
 {
     // MIX
@@ -444,6 +527,19 @@ void CounterTune_v2AudioProcessorEditor::setupParams()
     scaleTitleLabel.setMouseCursor(juce::MouseCursor::NormalCursor);
     scaleTitleLabel.setText("SCALE", dontSendNotification);
 
+    addAndMakeVisible(loadScalesButton);
+#ifdef JUCE_MAC
+    loadScalesButton.setBounds(180, 299, 60, 20);
+#else
+    loadScalesButton.setBounds(180, 300, 60, 20);
+#endif
+    loadScalesButton.setButtonText("LOAD");
+    loadScalesButton.setColour(juce::TextButton::buttonColourId, juce::Colours::transparentBlack);
+    loadScalesButton.setColour(juce::TextButton::textColourOffId, foregroundColor);
+    loadScalesButton.setColour(juce::ComboBox::outlineColourId, juce::Colours::transparentBlack);
+    loadScalesButton.setMouseCursor(juce::MouseCursor::PointingHandCursor);
+    loadScalesButton.onClick = [this]() { chooseUserScales(); };
+
     scaleAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(parameters, "scale", scaleKnob);
     scaleKnob.setSliderStyle(juce::Slider::LinearBar);
     scaleKnob.setColour(juce::Slider::textBoxOutlineColourId, juce::Colours::transparentBlack);
@@ -452,7 +548,7 @@ void CounterTune_v2AudioProcessorEditor::setupParams()
     scaleKnob.setColour(juce::Slider::thumbColourId, foregroundColor);
     scaleKnob.setTextBoxStyle(juce::Slider::NoTextBox, false, 0, 0);
     scaleKnob.setBounds(0, 320, 240, 20);
-    scaleKnob.setRange(1, 4, 1);
+    updateScaleRange();
     scaleKnob.onValueChange = [this]() { updateScaleValueLabel(); };
     addAndMakeVisible(scaleKnob);
 
@@ -467,7 +563,7 @@ void CounterTune_v2AudioProcessorEditor::setupParams()
     scaleValueLabel.setJustification(juce::Justification::topLeft);
     scaleValueLabel.setMultiLine(false);
     scaleValueLabel.setReturnKeyStartsNewLine(false);
-    scaleValueLabel.setInputRestrictions(10, "0123456789.-+");
+    scaleValueLabel.setInputRestrictions(32);
     scaleValueLabel.setSelectAllWhenFocused(true);
     scaleValueLabel.setColour(juce::TextEditor::textColourId, foregroundColor);
     scaleValueLabel.setColour(juce::TextEditor::backgroundColourId, backgroundColor);
@@ -479,15 +575,28 @@ void CounterTune_v2AudioProcessorEditor::setupParams()
         scaleValueLabel.moveCaretToEnd(false);
 
         juce::String text = scaleValueLabel.getText().trim();
-        int value = text.getIntValue();
         if (text.isEmpty())
         {
             updateScaleValueLabel();
             return;
         }
-        value = juce::jlimit(1, 4, value);
-        scaleKnob.setValue(value);
-        updateScaleValueLabel();
+
+        // A scale number, or a scale's name
+        int value = 0;
+        if (text.containsOnly("0123456789"))
+        {
+            value = juce::jlimit(1, audioProcessor.getNumScales(), text.getIntValue());
+        }
+        for (int scale = 1; value == 0 && scale <= audioProcessor.getNumScales(); ++scale)
+        {
+            if (audioProcessor.getScaleName(scale).equalsIgnoreCase(text)) value = scale;
+        }
+
+        if (value > 0)
+        {
+            scaleKnob.setValue(value);
+        }
+        updateScaleValueLabel(); // reverts if invalid
 
         grabKeyboardFocus();
     };
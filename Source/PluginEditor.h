@@ -19,6 +19,14 @@ public:
 private:
     void timerCallback() override;
 
+   #if COUNTERTUNE_PROFILING
+    // Stage timing overlay: cmd+shift+T shows it, cmd+shift+R resets the histograms, cmd+shift+D dumps them
+    // to CounterTune_stage_timings.json in the user's documents folder.
+    bool keyPressed(const juce::KeyPress& key) override;
+    void paintOverChildren(juce::Graphics& g) override;
+    bool showStageTimings = false;
+   #endif
+
     CounterTune_v2AudioProcessor& audioProcessor;
 
     bool firstLoad = true;
@@ -98,9 +106,10 @@ private:
     juce::TextEditor keyValueLabel;
     juce::StringArray keyNames{ "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
     juce::StringArray altKeyNames{ "C", "DB", "D", "EB", "E", "F", "GB", "G", "AB", "A", "BB", "B" };
+    int shownKey = -1; // the key and scale on the labels: the detected ones while auto key is on
     void updateKeyValueLabel()
     {
-        int value = audioProcessor.getKeyInt();
+        int value = shownKey = audioProcessor.getMelodyKey();
         juce::String text = (value >= 0 && value < keyNames.size()) ? keyNames[value] : juce::String(value);
         keyValueLabel.setText(text, false);
     }
@@ -109,14 +118,28 @@ private:
     juce::TextEditor scaleTitleLabel;
     juce::Slider scaleKnob;
     juce::TextEditor scaleValueLabel;
+    int shownScale = -1;
     void updateScaleValueLabel()
     {
-        int value = audioProcessor.getScaleInt();
-        juce::String text = juce::String(value);
+        int value = shownScale = audioProcessor.getMelodyScale();
+        juce::String text = audioProcessor.getScaleName(value).toUpperCase();
         scaleValueLabel.setText(text, false);
     }
     std::unique_ptr <juce::AudioProcessorValueTreeState::SliderAttachment> scaleAttachment;
 
+    // The knob only reaches the scales there are: the built-in ones and any user scales loaded
+    int shownNumScales = 0;
+    void updateScaleRange()
+    {
+        shownNumScales = audioProcessor.getNumScales();
+        scaleKnob.setRange(1, shownNumScales, 1);
+        updateScaleValueLabel();
+    }
+
+    juce::TextButton loadScalesButton;
+    std::unique_ptr<juce::FileChooser> scalesChooser;
+    void chooseUserScales();
+
     juce::TextEditor octaveTitleLabel;
     juce::Slider octaveKnob;
     juce::TextEditor octaveValueLabel;
@@ -178,8 +201,9 @@ private:
 
             g.setColour(juce::Colours::white);
 
-            float leftPoint = (11.0f - static_cast<float>(audioProcessor.uiInputNote)) * 43.64f;
-            float rightPoint = (11.0f - static_cast<float>(audioProcessor.uiOutputNote)) * 43.64f;
+            const auto notes = audioProcessor.getUiNotes();
+            float leftPoint = (11.0f - static_cast<float>(notes.input)) * 43.64f;
+            float rightPoint = (11.0f - static_cast<float>(notes.output)) * 43.64f;
 
             // Fixed background square (in local component coords)
             juce::Rectangle<float> fixedRect = getLocalBounds().toFloat();
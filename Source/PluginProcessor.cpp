@@ -16,46 +16,39 @@ CounterTune_v2AudioProcessor::CounterTune_v2AudioProcessor()
         parameters(*this, nullptr, "Parameters",
         {
             std::make_unique<juce::AudioParameterFloat>(juce::ParameterID{"mix", 1}, "Mix", 0.0f, 1.0f, 0.15f),
-            std::make_unique<juce::AudioParameterFloat>(juce::ParameterID{"tempo", 1}, "Tempo", 60, 240, 140),
-            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"period", 1}, "Period", 1, 32, 2),
+            std::make_unique<juce::AudioParameterFloat>(juce::ParameterID{"tempo", 1}, "Tempo", minTempo, maxTempo, 140),
+            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"period", 1}, "Period", 1, maxPeriod, 2),
             std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"density", 1}, "Density", 1, 6, 6),
             std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"key", 1}, "Key", 0, 11, 7),
-            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"scale", 1}, "Scale", 1, 4, 1),
-            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"octave", 1}, "Octave", -4, 4, 0),
-            std::make_unique<juce::AudioParameterFloat>(juce::ParameterID{"detune", 1}, "Detune", -1.0f, 1.0f, 0.0f)
+            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"scale", 1}, "Scale", 1, Scales::numScales, 1),
+            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"octave", 1}, "Octave", minOctave, maxOctave, 0),
+            std::make_unique<juce::AudioParameterFloat>(juce::ParameterID{"detune", 1}, "Detune", -1.0f, 1.0f, 0.0f),
+            std::make_unique<juce::AudioParameterChoice>(juce::ParameterID{"quality", 1}, "Quality", juce::StringArray{ "Draft", "Normal", "High" }, 0),
+            std::make_unique<juce::AudioParameterInt>(juce::ParameterID{"voices", 1}, "Voices", 1, maxHarmonyVoices, 1),
+            std::make_unique<juce::AudioParameterChoice>(juce::ParameterID{"harmony", 1}, "Harmony", juce::StringArray{ "Triad", "Unison" }, 0),
+            std::make_unique<juce::AudioParameterBool>(juce::ParameterID{"autokey", 1}, "Auto Key", false)
         })
 #endif
 {
-    dywapitch_inittracking(&pitchTracker);
-
-    uiWaveform.setSize(2, 1); // dummy initial size
-
-    synthesisBuffer.setSize(2, 1);
-
-    r_synthesisBuffer.setSize(2, 1); // init release buffer
-
-
-    offsetFractions.resize(tableSize);
-    detuneSemitones.resize(tableSize);
-    r_offsetFractions.resize(tableSize);
-    r_detuneSemitones.resize(tableSize);
-    for (int i = 0; i < tableSize; ++i)
-    {
-        offsetFractions[i] = (rnd.nextInt(9) + 8) * 0.01f;
-        detuneSemitones[i] = (rnd.nextInt(21) * 0.01f) - 0.10f;
-        r_offsetFractions[i] = offsetFractions[i];
-        r_detuneSemitones[i] = detuneSemitones[i];
-    }
-    offsetIndex = 0;
-    detuneIndex = 0;
-    r_offsetIndex = 0;
-    r_detuneIndex = 0;
-
-
+    mixParam = parameters.getRawParameterValue("mix");
+    tempoParam = parameters.getRawParameterValue("tempo");
+    periodParam = parameters.getRawParameterValue("period");
+    densityParam = parameters.getRawParameterValue("density");
+    keyParam = parameters.getRawParameterValue("key");
+    scaleParam = parameters.getRawParameterValue("scale");
+    octaveParam = parameters.getRawParameterValue("octave");
+    detuneParam = parameters.getRawParameterValue("detune");
+    qualityParam = parameters.getRawParameterValue("quality");
+    voicesParam = parameters.getRawParameterValue("voices");
+    harmonyParam = parameters.getRawParameterValue("harmony");
+    autoKeyParam = parameters.getRawParameterValue("autokey");
+
+    fillRandomTables();
 }
 
 CounterTune_v2AudioProcessor::~CounterTune_v2AudioProcessor()
 {
+    analysisPool->remove(analysisJob);
 }
 
 const juce::String CounterTune_v2AudioProcessor::getName() const
@@ -118,11 +111,120 @@ void CounterTune_v2AudioProcessor::changeProgramName (int index, const juce::Str
 {
 }
 
+void CounterTune_v2AudioProcessor::setRandomSeed(juce::int64 seed)
+{
+    rnd.setSeed(seed);
+    fillRandomTables();
+}
+
+juce::String CounterTune_v2AudioProcessor::loadUserScales(const juce::File& file)
+{
+    if (!file.existsAsFile())
+    {
+        return "can't find " + file.getFullPathName();
+    }
+
+    const auto error = scales.parseUserScales(file.loadFileAsString());
+    if (error.isNotEmpty())
+    {
+        scales.fromValueTree(parameters.state.getChildWithName("UserScales")); // keep the ones we had
+        return error;
+    }
+
+    parameters.state.removeChild(parameters.state.getChildWithName("UserScales"), nullptr);
+    parameters.state.appendChild(scales.toValueTree(), nullptr);
+    return {};
+}
+
+void CounterTune_v2AudioProcessor::fillRandomTables()
+{
+    offsetFractions.resize(tableSize);
+    detuneSemitones.resize(tableSize);
+    detuneSteps.resize(tableSize);
+    for (int i = 0; i < tableSize; ++i)
+    {
+        offsetFractions[i] = (rnd.nextInt(9) + 8) * 0.01f;
+        detuneSteps[i] = rnd.nextInt(TileCache::numRandomDetuneSteps);
+        detuneSemitones[i] = TileCache::detuneStepToSemitones(detuneSteps[i]);
+    }
+    offsetIndex = 0;
+    detuneIndex = 0;
+}
+
 void CounterTune_v2AudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     DBG("prepareToPlay called");
 
-    analysisBuffer.setSize(1, 1024, true);
+    // The analysis pool shares everything sized below, so take our job off it until we're done
+    analysisPool->remove(analysisJob);
+
+    // ~23 ms analysis window at any rate: 1024 samples at 44.1/48 kHz, 2048 at 88.2/96 kHz, 4096 at 176.4/192 kHz.
+    // The hop scales with it, so the overlap stays the same.
+    const int analysisFrameSize = dywapitch_framesizeforsamplerate(analysisFrameSizeAt44100, sampleRate);
+    const int analysisHopSize = analysisHopSizeAt44100.load() * analysisFrameSize / analysisFrameSizeAt44100;
+    pitchAnalyzer.prepare(sampleRate, analysisFrameSize, analysisHopSize);
+    keyDetector.prepare(sampleRate / analysisHopSize);
+
+    // Size everything the audio thread touches for the worst case, so processBlock never allocates.
+    // isolateBestNote keeps three analysis frames; the longest tile is that voice at the lowest pitch ratio.
+    maxVoiceSamples = 3 * analysisFrameSize;
+    maxTileSamples = static_cast<int>(std::ceil(maxVoiceSamples * std::pow(2.0f, maxDownwardShiftSemitones / 12.0f))) + 1;
+
+    resampler.prepare();
+
+    voiceTiles.forEachSlot([this](VoiceTile& tile) { reserveSamples(tile.samples, 2, maxVoiceSamples); });
+    for (auto& voiceBuffer : voiceBuffers)
+    {
+        reserveSamples(voiceBuffer, 2, maxVoiceSamples);
+    }
+    melodies.forEachSlot([](std::vector<int>& melody) { melody.assign(32, -2); });
+    reserveSamples(cacheVoice, 2, maxVoiceSamples);
+    for (auto& cache : tileCaches)
+    {
+        cache.prepare(2, 0); // sized by the worker for the tiles it builds
+    }
+    currentTileCache = &tileCaches[0];
+    pendingTileCache.store(nullptr);
+    retiredTileCache.store(&tileCaches[1]);
+    previousTileCache = nullptr;
+    uiWaveforms.forEachSlot([this](juce::AudioBuffer<float>& waveform) { reserveSamples(waveform, 2, maxVoiceSamples); });
+
+    // A voice learned (or restored from a session) at another rate is converted, so it keeps its pitch
+    if (voiceSampleRate != sampleRate && cacheVoice.getNumSamples() > 0)
+    {
+        voiceTiles.pull(); // anything unread is the same voice at the old rate
+        convertVoiceSampleRate(cacheVoice, voiceSampleRate, sampleRate);
+        voiceBuffers[voiceBufferIndex].makeCopyOf(cacheVoice, true);
+        voiceGeneration = ++cacheVoiceGeneration;
+    }
+    voiceSampleRate = sampleRate;
+
+    // The caches were just cleared; rebuild them for the voice we already have rather than wait for a new one
+    tileCacheDirty = cacheVoice.getNumSamples() > 0 && cacheVoiceNote >= 0;
+    requestedTileSettings = tileSettingsFor(0);
+    requestedTileVoices = getVoicesInt();
+    requestedTileHarmony = getHarmonyInt();
+
+    // Grains point into the caches and voice buffers just prepared
+    grains.stopAll();
+    harmonyLeadGrains.fill(-1);
+    harmonyUntilSpawn.fill(0.0f);
+    harmonyIntervals.fill(0);
+    harmonyGains.fill(1.0f);
+    numHarmonyVoices = 0;
+
+    const double maxCycleSamples = maxPeriod * (60.0 / minTempo * sampleRate / 4.0) + 4096;
+
+    // Capture ring holds a whole cycle at the slowest tempo and longest period; queue about a second of input
+    const int captureSize = juce::nextPowerOfTwo(static_cast<int>(maxCycleSamples));
+    if (inputAudioBuffer.getNumSamples() != captureSize)
+    {
+        inputAudioBuffer.setSize(2, captureSize);
+        inputAudioBuffer_mask = captureSize - 1;
+    }
+    analysisQueue.prepare(static_cast<int>(std::ceil(sampleRate / AnalysisMessage::maxSamples)) + 64);
+
+    scratch.reserve(ScratchArena::bytesFor<float>(samplesPerBlock)); // playback envelope block
 
     dryWetMixer.prepare(juce::dsp::ProcessSpec{ sampleRate, static_cast<std::uint32_t> (samplesPerBlock), static_cast<std::uint32_t> (getTotalNumOutputChannels()) });
     dryWetMixer.setMixingRule(juce::dsp::DryWetMixingRule::balanced);
@@ -134,16 +236,32 @@ void CounterTune_v2AudioProcessor::prepareToPlay (double sampleRate, int samples
 
     flicker.setSampleRate(sampleRate);
 
-    tailEnvelope.setSampleRate(sampleRate); // set for tail
+    // Buses can only change between prepareToPlay calls, so the channel count is fixed from here
+    processCore = getTotalNumOutputChannels() == 1 ? &CounterTune_v2AudioProcessor::processBlockFor<1>
+                                                   : &CounterTune_v2AudioProcessor::processBlockFor<2>;
+
+    resetAnalysis();
+    triggerCycle = false;
+    lastAnalysisRunState = analysisRunState.load();
 
     resetTiming();
-    generateMelody();
+    if (std::none_of(generatedMelody.begin(), generatedMelody.end(), [](int note) { return note >= 0; }))
+    {
+        generateMelody(generatedMelody, getMelodyKey(), getMelodyScale(), getDensityInt());
+    }
+    cacheMelody = generatedMelody;
+
+    // Offline renders analyse inline in processBlock instead, so they come out the same every time
+    analyseInline = isNonRealtime();
+    if (!analyseInline)
+        analysisPool->add(analysisJob);
 }
 
 void CounterTune_v2AudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    analysisPool->remove(analysisJob);
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -170,106 +288,135 @@ bool CounterTune_v2AudioProcessor::isBusesLayoutSupported (const BusesLayout& la
 
 void CounterTune_v2AudioProcessor::isolateBestNote()
 {
-    // Find the first occurrence of over 5 consecutive note numbers in detectedNoteNumbers & put it in lowResIsolatedChunks.
-    std::vector<int> lowResIsolatedChunks;
-    int lowResChunkFirstIdx = -1;
-    int lowResChunkLastIdx = -1;
-
-    if (detectedNoteNumbers.size() > 5)
+    // The first note held for longer than 5 analysis windows, found by the tracker as the frames came in
+    const int frameSize = pitchAnalyzer.getFrameSize();
+    const auto run = noteRuns.getFirstLongRun();
+    const int runNoteNumber = run.noteNumber;
+    const juce::int64 runFirstSample = run.firstSample;
+
+    // Skip the onset window and keep the next three
+    juce::int64 hiResSampleFirstIdx = runFirstSample + frameSize;
+    int hiResNumSamples = 3 * frameSize;
+
+    // BAIL OUT early if we didn't find a valid chunk inside this cycle's recording - keep existing voiceBuffer
+    const juce::int64 oldestCapturedSample = juce::jmax(inputAudioBuffer_cycleStartSample, inputAudioBuffer_endSample - inputAudioBuffer.getNumSamples());
+    if (runFirstSample == -1 || hiResSampleFirstIdx < oldestCapturedSample || hiResSampleFirstIdx + hiResNumSamples > inputAudioBuffer_endSample)
     {
-        size_t currentStart = 0;
-        for (size_t i = 1; i <= detectedNoteNumbers.size(); ++i)
-        {
-            if (i == detectedNoteNumbers.size() || detectedNoteNumbers[i] != detectedNoteNumbers[currentStart])
-            {
-                size_t length = i - currentStart;
-                if (length > 5)
-                {
-                    lowResIsolatedChunks.assign(detectedNoteNumbers.begin() + currentStart, detectedNoteNumbers.begin() + i);
-                    lowResChunkFirstIdx = static_cast<int>(currentStart);
-                    lowResChunkLastIdx = static_cast<int>(i - 1);
-                    break;
-                }
-                currentStart = i;
-            }
-        }
+        DBG("isolateBestNote: not enough data, keeping last valid voiceBuffer");
+        return;
     }
 
+    newVoiceNoteNumber.store(runNoteNumber);
 
-    // BAIL OUT early if we didn't find a valid chunk - keep existing voiceBuffer
-    if (lowResIsolatedChunks.size() < 5 || lowResChunkFirstIdx < 0)
+    // Generate voiceBuffer (single tile)
+    auto& tile = voiceTiles.getWriteBuffer();
+    auto& voiceBuffer = tile.samples;
+    tile.noteNumber = runNoteNumber;
+    voiceBuffer.setSize(inputAudioBuffer.getNumChannels(), hiResNumSamples, false, true, true);
+    const int ringStart = static_cast<int>(hiResSampleFirstIdx & inputAudioBuffer_mask);
+    const int firstPart = juce::jmin(hiResNumSamples, inputAudioBuffer.getNumSamples() - ringStart);
+    for (int ch = 0; ch < inputAudioBuffer.getNumChannels(); ++ch)
     {
-        DBG("isolateBestNote: not enough data, keeping last valid voiceBuffer");
-        return;
+        voiceBuffer.copyFrom(ch, 0, inputAudioBuffer, ch, ringStart, firstPart);
+        voiceBuffer.copyFrom(ch, firstPart, inputAudioBuffer, ch, 0, hiResNumSamples - firstPart);
+        bellCurve(voiceBuffer);
     }
 
+    tile.generation = ++cacheVoiceGeneration;
+    cacheVoice.makeCopyOf(voiceBuffer, true);
+    cacheVoiceNote = runNoteNumber;
+
+    voiceTiles.publish();
+    publishUiWaveform(voiceBuffer);
+}
 
-    // place the first 5 indices of lowResIsolatedChunks into midResIsolatedChunks
-    std::vector<int> midResIsolatedChunks;
-    int midResChunkFirstIdx = lowResChunkFirstIdx;
-    int midResChunkLastIdx = lowResChunkFirstIdx + 4;
+void CounterTune_v2AudioProcessor::publishUiWaveform(const juce::AudioBuffer<float>& voice)
+{
+    auto& uiWaveform = uiWaveforms.getWriteBuffer();
+    uiWaveform.makeCopyOf(voice, true);
 
-    if (lowResIsolatedChunks.size() >= 5)
+    // stylize waveform here
+    // Normalize the waveform to peak at 1.0
+    float peak = 0.0f;
+    for (int ch = 0; ch < uiWaveform.getNumChannels(); ++ch)
     {
-        midResIsolatedChunks.assign(lowResIsolatedChunks.begin(), lowResIsolatedChunks.begin() + 5);
+        peak = std::max(peak, uiWaveform.getMagnitude(ch, 0, uiWaveform.getNumSamples()));
     }
 
-    // populate hiResIsolatedChunks with the middle 3 indices of midResIsolatedChunks
-    std::vector<int> hiResIsolatedChunks;
-    int hiResChunkFirstIdx = midResChunkFirstIdx + 1;
-    int hiResChunkLastIdx = midResChunkLastIdx - 1;
-    hiResIsolatedChunks.assign(midResIsolatedChunks.begin() + 1, midResIsolatedChunks.begin() + 4);
-
-    int lowResSampleFirstIdx = lowResChunkFirstIdx * 1024;
-    int lowResSampleLastIdx = lowResChunkLastIdx * 1024;
-    int lowResNumSamples = lowResSampleLastIdx - lowResSampleFirstIdx + 1024;
-    int midResSampleFirstIdx = midResChunkFirstIdx * 1024;
-    int midResSampleLastIdx = midResChunkLastIdx * 1024;
-    int midResNumSamples = midResSampleLastIdx - midResSampleFirstIdx + 1024;
-    int hiResSampleFirstIdx = hiResChunkFirstIdx * 1024;
-    int hiResSampleLastIdx = hiResChunkLastIdx * 1024;
-    int hiResNumSamples = hiResSampleLastIdx - hiResSampleFirstIdx + 1024;
+    if (peak > 0.0f)
+    {
+        float gain = 1.0f / peak;
+        uiWaveform.applyGain(gain);
+    }
 
-    newVoiceNoteNumber.store(hiResIsolatedChunks[1]);
-    voiceNoteNumber.store(newVoiceNoteNumber);
+    uiWaveforms.publish();
+}
 
-    // Generate voiceBuffer (single tile)
-    voiceBuffer.setSize(inputAudioBuffer.getNumChannels(), hiResNumSamples, false, true, true);
-    for (int ch = 0; ch < inputAudioBuffer.getNumChannels(); ++ch)
+int CounterTune_v2AudioProcessor::startVoiceGrain(int semitoneOffset, int detuneStep, int fadeInLength, int voice, float gain)
+{
+    // Starts a grain of the current voice for one harmony voice, pitch-shifted for the given offset and detune
+    // step, fading in over fadeInLength samples. Returns its slot, or -1 if there's no voice yet.
+    const auto& voiceBuffer = voiceBuffers[voiceBufferIndex];
+    if (voiceBuffer.getNumSamples() == 0 || voiceNoteNumber.load() < 0)
     {
-        voiceBuffer.copyFrom(ch, 0, inputAudioBuffer, ch, hiResSampleFirstIdx, hiResNumSamples);
-        bellCurve(voiceBuffer);
-
-        uiWaveform = voiceBuffer;
-        // stylize waveform here
-        // Normalize the waveform to peak at 1.0
-        float peak = 0.0f;
-        for (int ch = 0; ch < uiWaveform.getNumChannels(); ++ch)
-        {
-            peak = std::max(peak, uiWaveform.getMagnitude(ch, 0, uiWaveform.getNumSamples()));
-        }
+        return -1;
+    }
 
-        if (peak > 0.0f)
+    // Play a pre-pitched tile if the worker has one for this voice and these knob settings
+    const auto settings = tileSettingsFor(voiceGeneration);
+    if (currentTileCache->getSettings() == settings)
+    {
+        const auto tile = currentTileCache->find(semitoneOffset, detuneStep);
+        if (tile.isValid())
         {
-            float gain = 1.0f / peak;
-            uiWaveform.applyGain(gain);
+            const Resampler::SourceView source{ tile.channels, tile.numChannels, tile.numSamples };
+            return grains.start(source, currentTileCache, 1.0, tile.numSamples, fadeInLength, gain, voice);
         }
     }
+
+    // Otherwise resample the voice as the grain plays
+    const double ratio = Resampler::semitonesToRatio(tileInterval(semitoneOffset, detuneStep, settings.octave, settings.detune));
+    const int tileSamples = juce::jmin(Resampler::getOutputLength(voiceBuffer.getNumSamples(), ratio), maxTileSamples);
+    return grains.start(Resampler::sourceOf(voiceBuffer), &voiceBuffer, ratio, tileSamples, fadeInLength, gain, voice);
 }
 
-void CounterTune_v2AudioProcessor::resetTiming()
+int CounterTune_v2AudioProcessor::harmonyInterval(int note, int voice) const noexcept
 {
-    if (!detectedFrequencies.empty() && std::all_of(detectedFrequencies.begin(), detectedFrequencies.end(), [](float f) { return f <= 0.0f; }))
+    // Triad mode stacks diatonic thirds in the melody's key and scale: voice 1 a third above, voice 2 a fifth,
+    // then the seventh, ninth and so on, up to maxHarmonyInterval; a voice that would go higher drops an octave.
+    // Scales of more than seven notes have no thirds of their own, so they harmonise as major. Unison voices all play the melody note and differ only in their random detune and
+    // spawn timing.
+    if (voice == 0 || getHarmonyInt() == harmonyUnison)
     {
-        triggerCycle = false;
-        isFirstCycle = true;
+        return 0;
     }
 
-    pitchDetectorFillPos = 0;
-    detectedFrequencies.clear();
-    detectedNoteNumbers.clear();
-    inputAudioBuffer.clear();
-    inputAudioBuffer_writePos.store(0);
+    const Scales::Degrees* degrees = &scales.getDegrees(getMelodyScale());
+    if (degrees->size > 7)
+    {
+        degrees = &scales.getDegrees(1);
+    }
+    const auto& steps = degrees->semitones;
+    const int size = degrees->size;
+
+    // Nearest degree at or below the note, then two degrees up per voice
+    const int pitchClass = ((note - getMelodyKey()) % 12 + 12) % 12;
+    int degree = 0;
+    for (int d = 1; d < size; ++d)
+    {
+        if (steps[static_cast<size_t>(d)] <= pitchClass) degree = d;
+    }
+    const int target = degree + 2 * voice;
+    int interval = steps[static_cast<size_t>(target % size)] + 12 * (target / size) - pitchClass;
+    while (interval > maxHarmonyInterval)
+    {
+        interval -= 12;
+    }
+    return interval;
+}
+
+void CounterTune_v2AudioProcessor::resetTiming()
+{
     phaseCounter = 0;
     std::fill(capturedMelody.begin(), capturedMelody.end(), -1);
 
@@ -280,98 +427,431 @@ void CounterTune_v2AudioProcessor::resetTiming()
     float currentSpeed = speed;
     sPs = static_cast<int>(std::round(60.0 / currentBpm * getSampleRate() / 4.0 * 1.0 / speed));
 
-//    int requiredSize = 32 * sPs + 4096;
-    int requiredSize = cycleLength * sPs + 4096;
-    inputAudioBuffer.setSize(2, requiredSize, false, true);
-    inputAudioBuffer_samplesToRecord.store(requiredSize);
-
     flickerParams.attack = 0.0f;
     flickerParams.decay = 0.0f;
     flickerParams.sustain = 1.0f;
     flickerParams.release = static_cast<float>(sPs) / static_cast<float>(getSampleRate());
     flicker.setParameters(flickerParams);
+}
+
+template <int NumChannels>
+void CounterTune_v2AudioProcessor::pushInputForAnalysis(const juce::AudioBuffer<float>& buffer, juce::int64 blockStartSample)
+{
+    const int numSamples = buffer.getNumSamples();
+
+    for (int offset = 0; offset < numSamples; offset += AnalysisMessage::maxSamples)
+    {
+        auto* message = analysisQueue.beginPush();
+        if (message == nullptr)
+        {
+            return; // worker is a second behind; drop input rather than wait
+        }
+
+        message->type = AnalysisMessage::Type::audio;
+        message->startSample = blockStartSample + offset;
+        message->numSamples = juce::jmin(AnalysisMessage::maxSamples, numSamples - offset);
+        message->numChannels = NumChannels;
+        for (int ch = 0; ch < NumChannels; ++ch)
+        {
+            juce::FloatVectorOperations::copy(message->samples[ch], buffer.getReadPointer(ch, offset), message->numSamples);
+        }
 
-    // duplicate for release envelope
-    tailEnvelopeParams.attack = 0.0f;
-    tailEnvelopeParams.decay = 0.0f;
-    tailEnvelopeParams.sustain = 1.0f;
-    tailEnvelopeParams.release = release;
-    tailEnvelope.setParameters(tailEnvelopeParams);
+        analysisQueue.finishPush();
+    }
 }
 
-void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+void CounterTune_v2AudioProcessor::pushAnalysisEvent(AnalysisMessage::Type type, juce::int64 startSample)
 {
-    juce::ScopedNoDenormals noDenormals;
+    auto* message = analysisQueue.beginPush();
+    if (message == nullptr)
+    {
+        return;
+    }
+
+    message->type = type;
+    message->startSample = startSample;
+    message->numSamples = 0;
+    message->key = getMelodyKey();
+    message->scale = getMelodyScale();
+    message->density = getDensityInt();
+    analysisQueue.finishPush();
+}
 
-    synchronizeBpm();
+void CounterTune_v2AudioProcessor::handOffAnalysis()
+{
+    // Rendering offline the queue is drained right here, so results land in the same block they would have
+    // synchronously. Otherwise a worker is woken for what was just queued; while the job is off the pool
+    // (a state restore, say) the queue just holds it until the job is back.
+    if (analyseInline)
+    {
+        AllocationGuard::ScopedAllow offlineAnalysis;
+        runAnalysis();
+    }
+    else if (analysisJob.isRegistered())
+    {
+        analysisPool->wake();
+    }
+}
 
-    int numSamples = buffer.getNumSamples();
+void CounterTune_v2AudioProcessor::requestTileRebuildOnKnobChange(juce::int64 blockStartSample)
+{
+    // The tiles depend on octave, detune and quality, and which ones are built on the voices and harmony. When
+    // any of those moves the worker rebuilds now, rather than the grains resampling live until the cycle ends.
+    // The voice generation is left out: a new voice already gets its tiles when the worker learns it.
+    const auto settings = tileSettingsFor(0);
+    const int voices = getVoicesInt();
+    const int harmony = getHarmonyInt();
+    if (settings == requestedTileSettings && voices == requestedTileVoices && harmony == requestedTileHarmony)
+    {
+        return;
+    }
 
-    // Mix current block to mono for pitch detection
-    juce::AudioBuffer<float> monoBlock(1, numSamples);
-    monoBlock.clear();
-    int numChannels = juce::jmin(getTotalNumInputChannels(), buffer.getNumChannels());
-    for (int ch = 0; ch < numChannels; ++ch)
+    requestedTileSettings = settings;
+    requestedTileVoices = voices;
+    requestedTileHarmony = harmony;
+    pushAnalysisEvent(AnalysisMessage::Type::rebuildTiles, blockStartSample);
+    handOffAnalysis();
+}
+
+bool CounterTune_v2AudioProcessor::runAnalysis()
+{
+    bool didWork = false;
+    while (auto* message = analysisQueue.front())
+    {
+        if (analysisJob.shouldStop())
+        {
+            return didWork; // being taken off the pool; the rest waits for when it's back
+        }
+
+        didWork = true;
+        switch (message->type)
+        {
+            case AnalysisMessage::Type::audio:
+                analyseInput(*message);
+                break;
+
+            case AnalysisMessage::Type::prepareMelody:
+                generateMelody(melodies.getWriteBuffer(), message->key, message->scale, message->density);
+                cacheMelody = melodies.getWriteBuffer();
+                melodies.publish();
+                break;
+
+            case AnalysisMessage::Type::endCycle:
+                endAnalysisCycle(message->startSample);
+                break;
+
+            case AnalysisMessage::Type::rebuildTiles:
+                tileCacheDirty = true; // once the queue is drained, so a run of knob moves builds once
+                break;
+        }
+
+        analysisQueue.pop();
+    }
+
+    if (tileCacheDirty)
+    {
+        rebuildTileCache();
+        didWork = true;
+    }
+
+    return didWork;
+}
+
+void CounterTune_v2AudioProcessor::rebuildTileCache()
+{
+    // Take back a cache the audio thread hasn't adopted yet, else the one it last let go of
+    TileCache* cache = pendingTileCache.exchange(nullptr);
+    if (cache == nullptr) cache = retiredTileCache.exchange(nullptr);
+    if (cache == nullptr)
+    {
+        tileCacheDirty = true; // the audio thread is between its two swaps; try again on the next wake
+        return;
+    }
+    tileCacheDirty = false;
+
+    const auto settings = tileSettingsFor(cacheVoiceGeneration);
+    cache->clear(settings);
+
+    if (cacheVoice.getNumSamples() > 0 && cacheVoiceNote >= 0)
+    {
+        const auto quality = static_cast<ResamplingEngine::Quality>(juce::jlimit(0, 2, settings.quality));
+        const auto source = Resampler::sourceOf(cacheVoice);
+        // Every offset from the voice the melody and its harmony voices play: the melody note's pitch class,
+        // plus each voice's interval above it, octaves included
+        bool offsetUsed[TileCache::numSemitoneOffsets] = {};
+        const int numVoices = juce::jlimit(1, maxHarmonyVoices, getVoicesInt());
+        for (int note : cacheMelody)
+        {
+            if (note < 0) continue;
+            for (int v = 0; v < numVoices; ++v)
+            {
+                const int semitoneOffset = (note % 12) - (cacheVoiceNote % 12) + harmonyInterval(note, v);
+                offsetUsed[semitoneOffset - TileCache::minSemitoneOffset] = true;
+            }
+        }
+
+        const auto tileRatio = [&](int semitoneOffset, int step)
+        {
+            return Resampler::semitonesToRatio(tileInterval(semitoneOffset, step, settings.octave, settings.detune));
+        };
+        const auto tileLength = [&](double ratio)
+        {
+            return juce::jmin(Resampler::getOutputLength(cacheVoice.getNumSamples(), ratio), maxTileSamples);
+        };
+
+        // Storage for exactly the tiles below, so the cache grows with the voice and the notes played
+        int totalSamples = 0;
+        for (int step = 0; step < TileCache::numDetuneSteps; ++step)
+        {
+            for (int i = 0; i < TileCache::numSemitoneOffsets; ++i)
+            {
+                if (offsetUsed[i]) totalSamples += tileLength(tileRatio(i + TileCache::minSemitoneOffset, step));
+            }
+        }
+        cache->reserve(cacheVoice.getNumChannels(), totalSamples);
+
+        // One tile per detune step for each of them, every unshifted tile first
+        for (int step = TileCache::numDetuneSteps - 1; step >= 0; --step)
+        {
+            for (int i = 0; i < TileCache::numSemitoneOffsets; ++i)
+            {
+                if (!offsetUsed[i]) continue;
+
+                if (analysisJob.shouldStop())
+                {
+                    // Being taken off the pool: give the half-built cache back and start over next time
+                    retiredTileCache.store(cache);
+                    tileCacheDirty = true;
+                    return;
+                }
+
+                const int semitoneOffset = i + TileCache::minSemitoneOffset;
+                const double ratio = tileRatio(semitoneOffset, step);
+                const int tileSamples = tileLength(ratio);
+                auto tile = cache->allocate(semitoneOffset, step, tileSamples);
+                if (tile.isValid())
+                {
+                    resampler.render(quality, source, { tile.channels, tile.numChannels, tileSamples }, 0, tileSamples, ratio, 0.0);
+                }
+            }
+        }
+    }
+
+    pendingTileCache.store(cache);
+}
+
+void CounterTune_v2AudioProcessor::analyseInput(const AnalysisMessage& message)
+{
+    // Mix to mono for pitch detection; mono input is analysed where it is
+    const float* analysisInput = message.samples[0];
+    float mono[AnalysisMessage::maxSamples] = {};
+    if (message.numChannels != 1)
     {
-        monoBlock.addFrom(0, 0, buffer, ch, 0, numSamples);
+        for (int ch = 0; ch < message.numChannels; ++ch)
+        {
+            juce::FloatVectorOperations::add(mono, message.samples[ch], message.numSamples);
+        }
+        if (message.numChannels > 0) juce::FloatVectorOperations::multiply(mono, 1.0f / message.numChannels, message.numSamples);
+        analysisInput = mono;
     }
-    if (numChannels > 0) monoBlock.applyGain(1.0f / numChannels);
-    auto* monoData = monoBlock.getReadPointer(0);
-    // Accumulate for pitch detection
-    int analysisSpaceLeft = analysisBuffer.getNumSamples() - pitchDetectorFillPos;
-    int analysisToCopy = juce::jmin(analysisSpaceLeft, numSamples);
-    analysisBuffer.copyFrom(0, pitchDetectorFillPos, monoData, analysisToCopy);
-    pitchDetectorFillPos += analysisToCopy;
-    // If full, detect pitch and store MIDI note
-    if (pitchDetectorFillPos >= analysisBuffer.getNumSamples())
+
+    // Sliding-window detection: one pitch (Hz, or 0.0 if none) per hop, stamped with the window's first sample
+    pitchAnalyzer.process(analysisInput, message.numSamples, message.startSample, [this, &message](double pitch, juce::int64 frameStartSample)
     {
-        // DYWAPitchTrack uses double*, but analysisBuffer is float*. Convert temporarily.
-        std::vector<double> doubleSamples(1024);
-        for (int i = 0; i < 1024; ++i)
-            doubleSamples[i] = analysisBuffer.getSample(0, i);
+        if (pitch != 0 && !analysisRunning)
+        {
+            // Heard a note: start following, and tell the audio thread to start a cycle
+            analysisRunning = true;
+            ++analysisGeneration;
+            inputAudioBuffer_cycleStartSample = message.startSample;
+            publishAnalysisState();
+
+            // dump first-chunk duplicate in first cycle after trigger
+            noteRuns.startCycle(pitchAnalyzer.getFrameSize(), isFirstCycle);
+        }
 
-        // Compute pitch (returns Hz, or 0.0 if no pitch detected).
-        double pitch = dywapitch_computepitch(&pitchTracker, doubleSamples.data(), 0, 1024);
-        pitch *= (getSampleRate() / 44100.0); // Scale for DYWAPitchTrack's 44100 assumption
+        const int midiNote = frequencyToMidiNote(static_cast<float>(pitch));
+        keyDetector.addFrame(midiNote);
 
-        if (pitch != 0)
+        if (analysisRunning)
         {
-            triggerCycle = true;
+            noteRuns.addFrame(midiNote, pitch > 0.0, frameStartSample);
+            latestDetectedNote.store(midiNote);
         }
+    });
+
+    // Record input continuously into the capture ring, addressed by the sample clock. Dropped messages are
+    // zeroed so they leave silence rather than stale audio.
+    const int ringSize = inputAudioBuffer.getNumSamples();
+    const int gap = static_cast<int>(juce::jlimit<juce::int64>(0, ringSize, message.startSample - inputAudioBuffer_endSample));
+    for (int done = 0; done < gap;)
+    {
+        const int pos = static_cast<int>((message.startSample - gap + done) & inputAudioBuffer_mask);
+        const int contiguous = juce::jmin(gap - done, ringSize - pos);
+        for (int ch = 0; ch < inputAudioBuffer.getNumChannels(); ++ch)
+        {
+            inputAudioBuffer.clear(ch, pos, contiguous);
+        }
+        done += contiguous;
+    }
+
+    for (int done = 0; done < message.numSamples;)
+    {
+        const int pos = static_cast<int>((message.startSample + done) & inputAudioBuffer_mask);
+        const int contiguous = juce::jmin(message.numSamples - done, ringSize - pos);
+        for (int ch = 0; ch < inputAudioBuffer.getNumChannels(); ++ch)
+        {
+            if (ch < message.numChannels)
+                inputAudioBuffer.copyFrom(ch, pos, message.samples[ch] + done, contiguous);
+            else
+                inputAudioBuffer.clear(ch, pos, contiguous);
+        }
+        done += contiguous;
+    }
+
+    inputAudioBuffer_endSample = message.startSample + message.numSamples;
+}
+
+void CounterTune_v2AudioProcessor::endAnalysisCycle(juce::int64 nextCycleStartSample)
+{
+    if (!analysisRunning)
+    {
+        return; // we stopped following before the audio thread found out
+    }
+
+    DBG("cycle end");
+
+    isFirstCycle = false;
+
+    // The key goes first, so the harmony tiles built below are in it
+    detectedKey.store(keyDetector.detect());
+
+    isolateBestNote();
+    rebuildTileCache();
+
+    // A silent cycle stops playback until the next note
+    if (noteRuns.wasSilent())
+    {
+        analysisRunning = false;
+        isFirstCycle = true;
+        publishAnalysisState();
+    }
+
+    noteRuns.startCycle(pitchAnalyzer.getFrameSize());
+    latestDetectedNote.store(noDetectedNote);
+    inputAudioBuffer_cycleStartSample = nextCycleStartSample;
+}
+
+void CounterTune_v2AudioProcessor::resetAnalysis()
+{
+    // Message thread only, with the worker stopped
+    while (analysisQueue.front() != nullptr)
+    {
+        analysisQueue.pop();
+    }
+
+    analysisRunning = false;
+    isFirstCycle = true;
+    publishAnalysisState();
+
+    noteRuns.startCycle(pitchAnalyzer.getFrameSize());
+    latestDetectedNote.store(noDetectedNote);
+    keyDetector.reset();
+    detectedKey.store(KeyDetector::noKey);
+    inputAudioBuffer.clear();
+    inputAudioBuffer_endSample = 0;
+    inputAudioBuffer_cycleStartSample = 0;
+}
+
+void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    juce::ignoreUnused(midiMessages);
+    (this->*processCore)(buffer);
+}
+
+template <int NumChannels>
+void CounterTune_v2AudioProcessor::processBlockFor(juce::AudioBuffer<float>& buffer)
+{
+    jassert(buffer.getNumChannels() >= NumChannels);
+
+    juce::ScopedNoDenormals noDenormals;
+    AllocationGuard::ScopedRealtime realtimeScope;
+    COUNTERTUNE_PROFILE_BLOCK(stageProfiler, buffer.getNumSamples(), getSampleRate());
+    COUNTERTUNE_SCOPED_STAGE(stageProfiler, wholeBlock);
+    scratch.reset();
+
+    {
+        // setValueNotifyingHost may allocate inside the host wrapper
+        AllocationGuard::ScopedAllow hostCallback;
+        synchronizeBpm();
+    }
+
+    int numSamples = buffer.getNumSamples();
+    const juce::int64 blockStartSample = processedSamples;
+    processedSamples += numSamples;
+
+    COUNTERTUNE_STAGE_BEGIN(stageProfiler, analysisHandOff);
+    pushInputForAnalysis<NumChannels>(buffer, blockStartSample);
+    handOffAnalysis();
+    COUNTERTUNE_STAGE_END(stageProfiler, analysisHandOff);
+
+    // Follow the worker: a new run state means it either heard a note (start a cycle) or found the
+    // last one silent (stop). Pick up any voice tile it has finished.
+    COUNTERTUNE_STAGE_BEGIN(stageProfiler, voiceHandOff);
+    const int runState = analysisRunState.load();
+    if (runState != lastAnalysisRunState)
+    {
+        lastAnalysisRunState = runState;
+        triggerCycle = (runState & 1) != 0;
 
         if (triggerCycle)
         {
-            detectedFrequencies.push_back(static_cast<float>(pitch));
-            int midiNote = frequencyToMidiNote(static_cast<float>(pitch));
-            detectedNoteNumbers.push_back(midiNote);
+            resetAllExecuted(symbolExecuted);
+            resetAllExecuted(playbackSymbolExecuted);
+            resetAllExecuted(fractionalSymbolExecuted);
+            resetTiming();
         }
+    }
+
+    if (voiceTiles.pull())
+    {
+        // Copy into whichever of our two buffers isn't playing; any grain still on it is two voices old
+        const int next = 1 - voiceBufferIndex;
+        grains.stopUsing(&voiceBuffers[next]);
+        voiceBuffers[next].makeCopyOf(voiceTiles.read().samples, true);
+        voiceBufferIndex = next;
+        voiceGeneration = voiceTiles.read().generation;
+        voiceNoteNumber.store(voiceTiles.read().noteNumber);
+    }
+
+    requestTileRebuildOnKnobChange(blockStartSample);
 
-        pitchDetectorFillPos = 0;
+    // A replaced tile cache goes back to the worker once no grain reads it, and only then is the next one taken
+    if (previousTileCache != nullptr && !grains.isUsing(previousTileCache))
+    {
+        retiredTileCache.store(previousTileCache);
+        previousTileCache = nullptr;
     }
-    // Handle overflow
-    if (analysisToCopy < numSamples)
+    if (previousTileCache == nullptr)
     {
-        analysisBuffer.copyFrom(0, 0, monoData + analysisToCopy, numSamples - analysisToCopy);
-        pitchDetectorFillPos = numSamples - analysisToCopy;
+        if (auto* cache = pendingTileCache.exchange(nullptr))
+        {
+            previousTileCache = currentTileCache;
+            currentTileCache = cache;
+        }
     }
+    COUNTERTUNE_STAGE_END(stageProfiler, voiceHandOff);
 
     // count stuff
 
     if (triggerCycle)
     {
+        COUNTERTUNE_STAGE_BEGIN(stageProfiler, sequencing);
+
         // phase counting variables
 //        int phaseAdvance = juce::jmin(((sPs * 32 + std::max(sampleDrift, 0)) - phaseCounter), numSamples);
         int phaseAdvance = juce::jmin(((sPs * cycleLength + std::max(sampleDrift, 0)) - phaseCounter), numSamples);
 
-        // High-resolution counter for recording input audio buffer
-        int spaceLeft = inputAudioBuffer_samplesToRecord.load() - inputAudioBuffer_writePos.load();
-        int toCopy = juce::jmin(numSamples, spaceLeft);
-        for (int ch = 0; ch < juce::jmin(getTotalNumInputChannels(), inputAudioBuffer.getNumChannels()); ++ch)
-        {
-            inputAudioBuffer.copyFrom(ch, inputAudioBuffer_writePos.load(), buffer, ch, 0, toCopy);
-        }
-        inputAudioBuffer_writePos.store(inputAudioBuffer_writePos.load() + toCopy);
-
         // Low-resolution counter for symbolically transcribing input audio
         for (int n = 0; n < cycleLength; ++n)
         {
@@ -379,14 +859,16 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
             {
                 if (!isExecuted(symbolExecuted, n))
                 {
-                    if (!detectedNoteNumbers.empty())
+                    const int latestNote = latestDetectedNote.load();
+                    if (latestNote != noDetectedNote)
                     {
-                        capturedMelody[n] = detectedNoteNumbers.back();
+                        capturedMelody[n] = latestNote;
 
                         // set ui input and output notes at same time
                         uiInputNote = voiceNoteNumber.load() % 12;
-                        if (detectedNoteNumbers.back() >= 0) uiInputNote = detectedNoteNumbers.back() % 12;
+                        if (latestNote >= 0) uiInputNote = latestNote % 12;
                         if (generatedMelody[n] >= 0) uiOutputNote = generatedMelody[n] % 12;
+                        publishUiNotes();
                     }
 
 //                    DBG(capturedMelody[n]);
@@ -407,8 +889,19 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
                 {
                     useFlicker.store(false);
 
-                    // DBG a running stream of generatedMelody values                    
-                    DBG(juce::String(generatedMelody[n]));
+                    // The melody the worker prepared takes over at the first step after it's ready: the start of
+                    // the next cycle, or a step or two into it if the worker ran late
+                    if (melodies.pull())
+                    {
+                        std::copy(melodies.read().begin(), melodies.read().end(), generatedMelody.begin());
+                    }
+
+                    // Have the next cycle's melody ready a step ahead of the cycle end
+                    if (n == cycleLength - 1)
+                    {
+                        pushAnalysisEvent(AnalysisMessage::Type::prepareMelody, blockStartSample);
+                        handOffAnalysis();
+                    }
 
 
                     // prepare a note for playback if there's a note number
@@ -420,17 +913,23 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
 
                         // prepare synthesis buffer with latest info
 
-                        // OCTAVE SHIFT AND DETUNE KNOB
-                        float octaveShift = static_cast<float>(getOctaveInt()) * 12.0f;
-                        float detuneShift = getDetuneFloat();
-                        float interval = static_cast<float>((playbackNote % 12) - (voiceNoteNumber.load() % 12)) + octaveShift + detuneShift;
-
-                        synthesisBuffer = pitchShift(voiceBuffer, (voiceNoteNumber.load() % 12), interval);
-
-//                        synthesisBuffer = pitchShift(voiceBuffer, (voiceNoteNumber.load() % 12), static_cast<float>((playbackNote % 12) - (voiceNoteNumber.load() % 12)));
-
-                        randomOffset = static_cast<int>(synthesisBuffer.getNumSamples() * offsetFractions[offsetIndex & (tableSize - 1)]);
-                        synthesisBuffer_readPos.store(0);
+                        // OCTAVE SHIFT AND DETUNE KNOB are applied in startVoiceGrain
+                        // A new note cuts whatever was playing, then every harmony voice starts its line. Voices past
+                        // the first start on a random detune, so unison voices don't begin phase-locked.
+                        grains.stopAll();
+                        numHarmonyVoices = juce::jlimit(1, maxHarmonyVoices, getVoicesInt());
+                        const float voiceGain = 1.0f / std::sqrt(static_cast<float>(numHarmonyVoices));
+                        for (int v = 0; v < numHarmonyVoices; ++v)
+                        {
+                            harmonyIntervals[v] = harmonyInterval(playbackNote, v);
+                            harmonyGains[v] = voiceGain;
+                            const int detuneStep = v == 0 ? TileCache::unshiftedStep : detuneSteps[(detuneIndex + v) & (tableSize - 1)];
+                            const int lead = startVoiceGrain(pitchClassOffsetFor(playbackNote) + harmonyIntervals[v], detuneStep, 0, v, harmonyGains[v]);
+                            harmonyLeadGrains[v] = lead;
+
+                            const int leadLength = lead >= 0 ? grains.getLength(lead) : 0;
+                            harmonyUntilSpawn[v] = static_cast<float>(static_cast<int>(leadLength * offsetFractions[(offsetIndex + v) & (tableSize - 1)]));
+                        }
 
 
                     }
@@ -461,30 +960,21 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
         }
 
         phaseCounter += phaseAdvance;
+        COUNTERTUNE_STAGE_END(stageProfiler, sequencing);
 
         // Low-res counter for stopping or resetting timing
 
         if (phaseCounter >= sPs * cycleLength + sampleDrift)
         {
-            DBG("cycle end");
+            COUNTERTUNE_SCOPED_STAGE(stageProfiler, cycleEnd);
 
             resetAllExecuted(symbolExecuted);
             resetAllExecuted(playbackSymbolExecuted);
             resetAllExecuted(fractionalSymbolExecuted);
 
-            // dump first-chunk duplicate in first cycle after trigger
-            if (isFirstCycle)
-            {
-                if (!detectedFrequencies.empty()) { detectedFrequencies.erase(detectedFrequencies.begin()); }
-                if (!detectedNoteNumbers.empty()) { detectedNoteNumbers.erase(detectedNoteNumbers.begin()); }
-                isFirstCycle = false;
-            }
-
-
-            generateMelody();
-
-
-            isolateBestNote();
+            // Voice extraction happens on the worker
+            pushAnalysisEvent(AnalysisMessage::Type::endCycle, blockStartSample + numSamples);
+            handOffAnalysis();
 
             resetTiming();
         }
@@ -494,101 +984,68 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
         dryWetMixer.pushDrySamples(block);
         block.clear();
 
-        // tile synthesis to output buffer
-        if (synthesisBuffer.getNumSamples() > 0)
+        // grain synthesis to output buffer
+        COUNTERTUNE_STAGE_BEGIN(stageProfiler, synthesis);
+        if (harmonyLeadGrains[0] >= 0 || grains.getNumActive() > 0) // grains still fading out play on after a failed spawn
         {
-            int numSamples = buffer.getNumSamples();
-            int synthesisBufferSize = synthesisBuffer.getNumSamples();
-            int readPos = synthesisBuffer_readPos.load();
-            int processed = 0;
+            // Every voice's grains mix straight into the output with vector ops
+            const auto quality = static_cast<ResamplingEngine::Quality>(juce::jlimit(0, 2, getQualityInt()));
+            grains.process<NumChannels>(resampler, quality, tileCrossfade, buffer.getArrayOfWritePointers(), numSamples);
 
-            for (int i = 0; i < numSamples; ++i)
+            // The envelope is the same for all of them, so it goes on the mix once rather than on each grain
+            if (useFlicker.load())
             {
-                int currentPos = readPos + i;
-
-                if (currentPos >= synthesisBufferSize) break;
-
-                float gain = 1.0f;
-                if (useFlicker.load()) gain = flicker.getNextSample();
-
-                for (int ch = 0; ch < juce::jmin(buffer.getNumChannels(), synthesisBuffer.getNumChannels()); ++ch)
+                float* gain = scratch.allocate<float>(numSamples);
+                if (gain != nullptr)
                 {
-                     buffer.addSample(ch, i, synthesisBuffer.getSample(ch, currentPos) * gain);
+                    juce::FloatVectorOperations::fill(gain, 1.0f, numSamples);
+                    juce::AudioBuffer<float> gainBlock(&gain, 1, numSamples);
+                    flicker.applyEnvelopeToBuffer(gainBlock, 0, numSamples);
+                    for (int ch = 0; ch < NumChannels; ++ch)
+                    {
+                        juce::FloatVectorOperations::multiply(buffer.getWritePointer(ch), gain, numSamples);
+                    }
                 }
-
-                processed = i + 1;
             }
 
-            synthesisBuffer_readPos.store(readPos + processed);
-
-            // spawn synthesis tiles
-            if (synthesisBuffer_readPos.load() >= randomOffset)
+            // spawn grains, each voice timed off its own lead grain, which played the block just mixed
+            juce::FloatVectorOperations::add(harmonyUntilSpawn.data(), -static_cast<float>(numSamples), numHarmonyVoices);
+            for (int v = 0; v < numHarmonyVoices; ++v)
             {
-                juce::AudioBuffer<float> baseTile;
-                juce::AudioBuffer<float> newTile;
-
-                int remainingSamples = synthesisBuffer.getNumSamples() - synthesisBuffer_readPos.load();
-                if (remainingSamples < 0) remainingSamples = 0;
-
-                randomPitch = detuneSemitones[detuneIndex & (tableSize - 1)];
-                ++detuneIndex;
-
-                // OCTAVE SHIFT AND DETUNE KNOB
-                float octaveShift = static_cast<float>(getOctaveInt()) * 12.0f;
-                float detuneShift = getDetuneFloat();
-                float interval = static_cast<float>((playbackNote % 12) - (voiceNoteNumber.load() % 12)) + octaveShift + detuneShift;
-
-                newTile = pitchShift(voiceBuffer, (voiceNoteNumber.load() % 12), interval + randomPitch);
-
-//                newTile = pitchShift(voiceBuffer, (voiceNoteNumber.load() % 12), static_cast<float>((playbackNote % 12) - (voiceNoteNumber.load() % 12)) + randomPitch);
-
+                const int lead = harmonyLeadGrains[v];
+                if (lead < 0) continue;
 
-                // Calculate overlap and non-overlap first
-                int overlapSamples = juce::jmin(remainingSamples, newTile.getNumSamples());
-                int nonOverlapSamples = newTile.getNumSamples() - overlapSamples;
-
-                // Set size correctly: remaining (to be crossfaded) + non-overlap append
-                baseTile.setSize(synthesisBuffer.getNumChannels(), remainingSamples + nonOverlapSamples, false, true, true);
-
-                // Copy remaining to first tile start
-                for (int ch = 0; ch < synthesisBuffer.getNumChannels(); ++ch)
+                const bool ownLead = grains.isActive(lead) && grains.getVoice(lead) == v; // else its slot went to another voice
+                if (ownLead && harmonyUntilSpawn[v] > 0.0f)
                 {
-                    baseTile.copyFrom(ch, 0, synthesisBuffer, ch, synthesisBuffer_readPos.load(), remainingSamples);
+                    continue;
                 }
 
-                // Crossfade the overlap region
-                for (int ch = 0; ch < baseTile.getNumChannels(); ++ch)
-                {
-                    float* baseData = baseTile.getWritePointer(ch);
-                    const float* newData = newTile.getReadPointer(ch);
+                // A voice that lost its lead grain to another one still crossfades, rather than cutting in
+                int remainingSamples = ownLead ? grains.getRemaining(lead) : minSpawnCrossfade;
 
-                    for (int i = 0; i < overlapSamples; ++i)
-                    {
-                        float fadeOut = 1.0f - static_cast<float>(i) / static_cast<float>(overlapSamples);
-                        float fadeIn = static_cast<float>(i) / static_cast<float>(overlapSamples);
-                        baseData[i] = baseData[i] * fadeOut + newData[i] * fadeIn;
-                    }
-                }
+                randomPitch = detuneSemitones[detuneIndex & (tableSize - 1)];
+                int detuneStep = detuneSteps[detuneIndex & (tableSize - 1)];
+                ++detuneIndex;
+
+                // OCTAVE SHIFT AND DETUNE KNOB are applied in startVoiceGrain
+                int semitoneOffset = pitchClassOffsetFor(playbackNote) + harmonyIntervals[v];
 
-                // Append any non-overlapping part of newTile
-                if (nonOverlapSamples > 0)
+                const int incoming = startVoiceGrain(semitoneOffset, detuneStep, 0, v, harmonyGains[v]);
+                harmonyLeadGrains[v] = incoming;
+                if (incoming < 0)
                 {
-                    for (int ch = 0; ch < baseTile.getNumChannels(); ++ch)
-                    {
-                        baseTile.copyFrom(ch, overlapSamples, newTile, ch, overlapSamples, nonOverlapSamples);
-                    }
+                    grains.fadeOutVoice(v, remainingSamples);
+                    continue; // no voice to play: the line stops until the next note
                 }
 
-                synthesisBuffer = std::move(baseTile);
-                synthesisBuffer_readPos.store(0);
-
-
-
-
-                randomOffset = static_cast<int>(synthesisBuffer.getNumSamples() * offsetFractions[offsetIndex & (tableSize - 1)]);
+                // The new grain takes over from where playback is now. The crossfade is over before the next
+                // spawn, so only the outgoing and incoming grain ever overlap, on complementary windows.
+                const int spawnAt = static_cast<int>(grains.getLength(incoming) * offsetFractions[offsetIndex & (tableSize - 1)]);
+                harmonyUntilSpawn[v] = static_cast<float>(spawnAt);
+                grains.crossfadeVoice(v, incoming, juce::jmax(1, juce::jmin(remainingSamples, spawnAt)));
                 ++offsetIndex;
             }
-                        
         }
 
 
@@ -597,10 +1054,13 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
 
 
 
+        COUNTERTUNE_STAGE_END(stageProfiler, synthesis);
+
         // Add limiter to wet signal ...
         //juce::dsp::ProcessContextReplacing<float> limiterContext(block);
         //wetLimiter.process(limiterContext);
 
+        COUNTERTUNE_STAGE_BEGIN(stageProfiler, output);
         const float gainBoost = juce::Decibels::decibelsToGain(9.0f);
         block.multiplyBy(gainBoost);   // +9 dB on wet only
 
@@ -611,49 +1071,27 @@ void CounterTune_v2AudioProcessor::processBlock (juce::AudioBuffer<float>& buffe
 
         dryWetMixer.setWetMixProportion(getMixFloat());
         dryWetMixer.mixWetSamples(block);
-
+        COUNTERTUNE_STAGE_END(stageProfiler, output);
     }
 }
 
-void CounterTune_v2AudioProcessor::generateMelody()
+void CounterTune_v2AudioProcessor::generateMelody(std::vector<int>& melody, int key, int scale, int density)
 {
-    //// populate each index of the generatedMelody vector with a random number from 60 to 72
-    //for (auto& note : generatedMelody)
-    //{
-    //    note = 60 + rnd.nextInt(13);  // rnd.nextInt(13) gives 0-12 - 60-72 inclusive
-    //}
-
-    int rootNote = 60 + getKeyInt();
-
-    // Scale note offsets
-    const std::vector<std::vector<int>> scaleDefs = {
-        {}, // dummy index 0
-        {0, 2, 4, 5, 7, 9, 11}, // 1 = major
-        {0, 2, 4, 5, 7, 8, 11}, // 2 = harmonic major
-        {0, 2, 4, 7, 9}, // 3 = pentatonic
-        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11} // 4 = chromatic
-    };
-
-    const auto& intervals = scaleDefs[getScaleInt()];
-
-    std::vector<int> availableNotes;
-    for (int offset : intervals)
-        availableNotes.push_back(rootNote + offset);
+    // Table lookups only, so it's safe on any thread: the scale's degrees come precomputed from its pitch-class
+    // mask, and the melody is refilled in place.
+    const int rootNote = 60 + key;
+    const auto& degrees = scales.getDegrees(scale);
 
     // rhythmic density step sizes
     const int stepSizes[7] = { 0, 32, 16, 8, 4, 2, 1 };
-    int step = stepSizes[getDensityInt()];
+    const int step = stepSizes[juce::jlimit(1, 6, density)];
 
-    // fill generatedMelody
-    generatedMelody.assign(32, -2);
+    // fill melody
+    melody.assign(32, -2);
 
     for (int i = 0; i < 32; i += step)
     {
-        if (!availableNotes.empty())
-        {
-            int idx = rnd.nextInt(static_cast<int>(availableNotes.size()));
-            generatedMelody[i] = availableNotes[idx];
-        }
+        melody[static_cast<size_t>(i)] = rootNote + degrees.semitones[static_cast<size_t>(rnd.nextInt(degrees.size))];
     }
 }
 
@@ -669,12 +1107,207 @@ juce::AudioProcessorEditor* CounterTune_v2AudioProcessor::createEditor()
 
 void CounterTune_v2AudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    
+    // Binary state: a small header, then the parameter tree, the melody and the learned voice, all optionally
+    // gzipped. The voice goes in whole, so a reloaded session plays from its first cycle instead of re-learning.
+    juce::AudioBuffer<float> voice;
+    std::vector<int> melody(generatedMelody.size());
+    int noteNumber = -1;
+    for (bool copied = false; !copied;)
+    {
+        // Snapshot what the audio thread plays. The lock is only held to copy into storage sized beforehand, so
+        // the audio thread never waits on an allocation; if the voice changed in between, size up again.
+        int generation = 0, numChannels = 0, numSamples = 0;
+        {
+            const juce::ScopedLock lock(getCallbackLock());
+            generation = voiceGeneration;
+            numChannels = voiceBuffers[voiceBufferIndex].getNumChannels();
+            numSamples = voiceBuffers[voiceBufferIndex].getNumSamples();
+        }
+        voice.setSize(numChannels, numSamples, false, false, true);
+
+        const juce::ScopedLock lock(getCallbackLock());
+        const auto& playing = voiceBuffers[voiceBufferIndex];
+        if (voiceGeneration != generation || playing.getNumChannels() != numChannels || playing.getNumSamples() != numSamples)
+        {
+            continue;
+        }
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            voice.copyFrom(ch, 0, playing, ch, 0, numSamples);
+        }
+        noteNumber = voiceNoteNumber.load();
+        std::copy(generatedMelody.begin(), generatedMelody.end(), melody.begin());
+        copied = true;
+    }
+
+    juce::MemoryOutputStream payload;
+    parameters.copyState().writeToStream(payload);
+
+    payload.writeByte(static_cast<char>(melody.size()));
+    for (int note : melody)
+    {
+        payload.writeByte(static_cast<char>(juce::jlimit(-128, 127, note)));
+    }
+
+    payload.writeInt(noteNumber);
+    payload.writeDouble(voiceSampleRate);
+    payload.writeByte(static_cast<char>(voice.getNumChannels()));
+    payload.writeInt(voice.getNumSamples());
+    for (int ch = 0; ch < voice.getNumChannels(); ++ch)
+    {
+        const float* samples = voice.getReadPointer(ch);
+        for (int i = 0; i < voice.getNumSamples(); ++i)
+        {
+            payload.writeFloat(samples[i]);
+        }
+    }
+
+    juce::MemoryOutputStream out(destData, false);
+    out.writeInt(stateMagic);
+    out.writeInt(stateVersion);
+    out.writeBool(compressState);
+    if (compressState)
+    {
+        juce::GZIPCompressorOutputStream zipped(out);
+        zipped.write(payload.getData(), payload.getDataSize());
+    }
+    else
+    {
+        out.write(payload.getData(), payload.getDataSize());
+    }
 }
 
 void CounterTune_v2AudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    
+    juce::MemoryInputStream in(data, static_cast<size_t>(sizeInBytes), false);
+    if (sizeInBytes < 9 || in.readInt() != stateMagic || in.readInt() > stateVersion)
+    {
+        return; // not ours, or written by a newer version
+    }
+
+    const bool compressed = in.readBool();
+    juce::MemoryBlock payloadData;
+    if (compressed)
+    {
+        juce::GZIPDecompressorInputStream unzipped(in);
+        unzipped.readIntoMemoryBlock(payloadData);
+    }
+    else
+    {
+        in.readIntoMemoryBlock(payloadData);
+    }
+    juce::MemoryInputStream payload(payloadData, false);
+
+    const auto tree = juce::ValueTree::readFromStream(payload);
+    if (tree.hasType(parameters.state.getType()))
+    {
+        parameters.replaceState(tree);
+        scales.fromValueTree(parameters.state.getChildWithName("UserScales"));
+        stateLoaded = true; // keep the saved tempo rather than taking the host's
+    }
+
+    std::vector<int> melody(static_cast<size_t>(static_cast<juce::uint8>(payload.readByte())));
+    for (auto& note : melody)
+    {
+        note = payload.readByte();
+    }
+
+    const int noteNumber = payload.readInt();
+    const double sampleRate = payload.readDouble();
+    const int numChannels = payload.readByte();
+    const int numSamples = payload.readInt();
+    if (melody.size() != generatedMelody.size() || noteNumber < 0 || numChannels < 1 || numChannels > 2
+        || numSamples < 1 || numSamples > maxStoredVoiceSamples
+        || payload.getNumBytesRemaining() < static_cast<juce::int64>(numChannels) * numSamples * 4)
+    {
+        return; // parameters only: a state saved before any voice was learned, or a truncated one
+    }
+
+    juce::AudioBuffer<float> voice(numChannels, numSamples);
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        float* samples = voice.getWritePointer(ch);
+        for (int i = 0; i < numSamples; ++i)
+        {
+            samples[i] = payload.readFloat();
+        }
+    }
+
+    restoreVoice(voice, noteNumber, sampleRate, melody);
+}
+
+void CounterTune_v2AudioProcessor::restoreVoice(juce::AudioBuffer<float>& voice, int noteNumber, double sampleRate, const std::vector<int>& melody)
+{
+    // Message thread. With our job off the analysis pool the worker's copies are ours to replace; the callback
+    // lock is then held only to swap the audio thread's copies, so the audio thread plays it from its next block.
+    if (getSampleRate() > 0.0)
+    {
+        convertVoiceSampleRate(voice, sampleRate, getSampleRate());
+        sampleRate = getSampleRate();
+    }
+
+    // Taking the job off can wait for a tile render, so it happens with the audio thread still running.
+    // Rendering offline the audio thread is the worker, so there its copies are only ours under the lock.
+    const bool wasOnPool = analysisJob.isRegistered();
+    analysisPool->remove(analysisJob);
+    const juce::CriticalSection noLock;
+    const juce::ScopedLock workerLock(analyseInline ? getCallbackLock() : noLock);
+
+    cacheVoice.makeCopyOf(voice, true);
+    cacheVoiceNote = noteNumber;
+    cacheMelody = melody;
+    tileCacheDirty = true;
+    publishUiWaveform(voice);
+
+    // The audio thread's new copy is allocated here, with room for any voice it may copy in later
+    juce::AudioBuffer<float> incoming;
+    reserveSamples(incoming, 2, juce::jmax(maxVoiceSamples, voice.getNumSamples()));
+    incoming.makeCopyOf(voice, true);
+
+    {
+        const juce::ScopedLock lock(getCallbackLock());
+
+        // Drop anything published but not yet picked up, so it can't replace what we restore
+        voiceTiles.pull();
+        melodies.pull();
+
+        const int next = 1 - voiceBufferIndex;
+        grains.stopUsing(&voiceBuffers[next]);
+        std::swap(voiceBuffers[next], incoming);
+        voiceBufferIndex = next;
+        voiceGeneration = ++cacheVoiceGeneration;
+        voiceNoteNumber.store(noteNumber);
+        newVoiceNoteNumber.store(noteNumber);
+        voiceSampleRate = sampleRate;
+        std::copy(melody.begin(), melody.end(), generatedMelody.begin());
+    }
+
+    if (wasOnPool)
+    {
+        analysisPool->add(analysisJob);
+    }
+}
+
+void CounterTune_v2AudioProcessor::convertVoiceSampleRate(juce::AudioBuffer<float>& voice, double fromRate, double toRate)
+{
+    if (fromRate <= 0.0 || toRate <= 0.0 || fromRate == toRate || voice.getNumSamples() == 0)
+    {
+        return;
+    }
+
+    const double ratio = fromRate / toRate;
+    juce::AudioBuffer<float> converted(voice.getNumChannels(), Resampler::getOutputLength(voice.getNumSamples(), ratio));
+    Resampler::render(Resampler::sourceOf(voice), Resampler::destinationOf(converted), 0, converted.getNumSamples(), ratio, 0.0);
+
+    // Tiles are sized for the longest voice at this rate; past that, cut and fade rather than overrun them
+    if (maxVoiceSamples > 0 && converted.getNumSamples() > maxVoiceSamples)
+    {
+        const int fadeSamples = maxVoiceSamples / 8;
+        converted.setSize(converted.getNumChannels(), maxVoiceSamples, true, false, true);
+        converted.applyGainRamp(maxVoiceSamples - fadeSamples, fadeSamples, 1.0f, 0.0f);
+    }
+
+    voice = std::move(converted);
 }
 
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
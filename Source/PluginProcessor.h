@@ -4,6 +4,20 @@
 
 #include <JuceHeader.h>
 #include "dywapitchtrack.h"
+#include "PitchAnalyzer.h"
+#include "ScratchArena.h"
+#include "Resampler.h"
+#include "Crossfade.h"
+#include "TileCache.h"
+#include "GrainPool.h"
+#include "AllocationGuard.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+#include "StageProfiler.h"
+#include "AnalysisPool.h"
+#include "NoteRunTracker.h"
+#include "KeyDetector.h"
+#include "Scales.h"
 
 class CounterTune_v2AudioProcessor  : public juce::AudioProcessor
 {
@@ -31,30 +45,80 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
-    float getMixFloat() const { return *parameters.getRawParameterValue("mix"); }
+    float getMixFloat() const { return *mixParam; }
     void setMixFloat(float newMixFloat) { auto* param = parameters.getParameter("mix"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newMixFloat)); }
     
-    float getTempoFloat() const { return *parameters.getRawParameterValue("tempo"); }
+    float getTempoFloat() const { return *tempoParam; }
     void setTempoFloat(float newTempoFloat) { auto* param = parameters.getParameter("tempo"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newTempoFloat)); }
 
-    int getPeriodInt() const { return *parameters.getRawParameterValue("period"); }
+    int getPeriodInt() const { return *periodParam; }
     void setPeriodInt(int newPeriodInt) { auto* param = parameters.getParameter("period"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newPeriodInt)); }
 
-    int getDensityInt() const { return *parameters.getRawParameterValue("density"); }
+    int getDensityInt() const { return *densityParam; }
     void setDensityInt(int newDensityInt) { auto* param = parameters.getParameter("density"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newDensityInt)); }
 
-    int getKeyInt() const { return *parameters.getRawParameterValue("key"); }
+    int getKeyInt() const { return *keyParam; }
     void setKeyInt(int newKeyInt) { auto* param = parameters.getParameter("key"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newKeyInt)); }
 
-    int getScaleInt() const { return *parameters.getRawParameterValue("scale"); }
+    int getScaleInt() const { return *scaleParam; }
     void setScaleInt(int newScaleInt) { auto* param = parameters.getParameter("scale"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newScaleInt)); }
 
-    int getOctaveInt() const { return *parameters.getRawParameterValue("octave"); }
+    int getOctaveInt() const { return *octaveParam; }
     void setOctaveInt(int newOctaveInt) { auto* param = parameters.getParameter("octave"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newOctaveInt)); }
 
-    float getDetuneFloat() const { return *parameters.getRawParameterValue("detune"); }
+    float getDetuneFloat() const { return *detuneParam; }
     void setDetuneFloat(float newDetuneFloat) { auto* param = parameters.getParameter("detune"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newDetuneFloat)); }
 
+    int getQualityInt() const { return *qualityParam; }
+    void setQualityInt(int newQualityInt) { auto* param = parameters.getParameter("quality"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newQualityInt)); }
+
+    int getVoicesInt() const { return *voicesParam; }
+    void setVoicesInt(int newVoicesInt) { auto* param = parameters.getParameter("voices"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newVoicesInt)); }
+
+    int getHarmonyInt() const { return *harmonyParam; }
+    void setHarmonyInt(int newHarmonyInt) { auto* param = parameters.getParameter("harmony"); auto range = param->getNormalisableRange(); param->setValueNotifyingHost(range.convertTo0to1(newHarmonyInt)); }
+
+    bool getAutoKeyBool() const { return *autoKeyParam > 0.5f; }
+    void setAutoKeyBool(bool newAutoKeyBool) { parameters.getParameter("autokey")->setValueNotifyingHost(newAutoKeyBool ? 1.0f : 0.0f); }
+
+    // The key heard in the input (KeyDetector numbering), or KeyDetector::noKey. Updated at the end of each cycle.
+    int getDetectedKey() const { return detectedKey.load(); }
+
+    // What the melody and harmony actually use: the detected key as major or natural minor while autokey is on
+    // and a key has been heard, otherwise the key and scale parameters. A scale parameter past the user scales
+    // loaded plays the last one there is.
+    int getMelodyKey() const
+    {
+        const int key = detectedKey.load();
+        return getAutoKeyBool() && key != KeyDetector::noKey ? KeyDetector::tonicOf(key) : getKeyInt();
+    }
+    int getMelodyScale() const
+    {
+        const int key = detectedKey.load();
+        if (getAutoKeyBool() && key != KeyDetector::noKey)
+            return KeyDetector::isMinor(key) ? Scales::naturalMinorScale : Scales::majorScale;
+        return juce::jmin(getScaleInt(), scales.getNumScales());
+    }
+
+    // Analysis hop in samples at 44.1 kHz (scaled with the window at other rates); applied at the next prepareToPlay.
+    void setAnalysisHopSize(int samplesAt44100) { analysisHopSizeAt44100.store(juce::jlimit(1, analysisFrameSizeAt44100, samplesAt44100)); }
+    int getAnalysisHopSize() const { return analysisHopSizeAt44100.load(); }
+
+    // Session state is binary: parameters, melody and the learned voice. Compression is off by default, since
+    // audio barely shrinks and loading is faster without it; either kind of state loads.
+    void setStateCompression(bool shouldCompress) { compressState = shouldCompress; }
+
+    // Reseeds the random source behind melody generation and tile offsets/detunes, so a render with the same
+    // input and parameters comes out the same every time. Message thread only, before prepareToPlay.
+    void setRandomSeed(juce::int64 seed);
+
+    // User scales follow the built-in ones on the scale parameter and are saved with the session. Loading
+    // replaces any already loaded; see Scales::ScaleSet::parseUserScales for the file format. Message thread;
+    // returns an error message, or an empty string.
+    juce::String loadUserScales(const juce::File& file);
+    juce::String getScaleName(int scaleNumber) const { return scales.getName(scaleNumber); }
+    int getNumScales() const noexcept { return scales.getNumScales(); }
+
     float getDefaultBpmFromHost()
     {
         // Default value in case we can't get BPM from host
@@ -104,13 +168,77 @@ public:
 
 
 
-    juce::AudioBuffer<float> uiWaveform;
-    int uiInputNote = -1;
-    int uiOutputNote = -1;
+    // Editor hand-off. Message thread only; never touches memory the audio or analysis threads are using.
+    // pullUiWaveform() takes the newest published waveform, which getUiWaveform() then returns until the next pull.
+    bool pullUiWaveform() noexcept { return uiWaveforms.pull(); }
+    const juce::AudioBuffer<float>& getUiWaveform() const noexcept { return uiWaveforms.read(); }
+
+    struct UiNotes { int input = -1; int output = -1; };
+    UiNotes getUiNotes() const noexcept
+    {
+        const auto packed = uiNotes.load();
+        return { static_cast<std::int16_t>(packed & 0xffff), static_cast<std::int16_t>(packed >> 16) };
+    }
+
+   #if COUNTERTUNE_PROFILING
+    // processBlock stage timings as a share of the block's real-time budget; readable from any thread.
+    StageProfiler& getStageProfiler() noexcept { return stageProfiler; }
+   #endif
 
     juce::AudioProcessorValueTreeState parameters;
 
+    // parameter ranges that the preallocated buffers are sized against
+    constexpr static float minTempo = 60.0f;
+    constexpr static float maxTempo = 240.0f;
+    constexpr static int maxPeriod = 32;
+    constexpr static int minOctave = -4;
+    constexpr static int maxOctave = 4;
+    constexpr static int maxHarmonyVoices = 8;
+    constexpr static int maxHarmonyInterval = 24; // semitones above the melody note
+    static_assert(11 + maxHarmonyInterval <= TileCache::maxSemitoneOffset, "every harmony note needs a tile slot");
+    constexpr static int minSpawnCrossfade = 256; // samples, for a voice whose lead grain slot was taken
+
+    enum HarmonyMode { harmonyTriad = 0, harmonyUnison };
+
 private:
+    friend class ProcessorBenchmark; // Tools/Benchmark times the private hot paths directly
+
+    // Cached raw parameter pointers; looking a parameter up by ID builds a juce::String, which allocates.
+    std::atomic<float>* mixParam = nullptr;
+    std::atomic<float>* tempoParam = nullptr;
+    std::atomic<float>* periodParam = nullptr;
+    std::atomic<float>* densityParam = nullptr;
+    std::atomic<float>* keyParam = nullptr;
+    std::atomic<float>* scaleParam = nullptr;
+    std::atomic<float>* octaveParam = nullptr;
+    std::atomic<float>* detuneParam = nullptr;
+    std::atomic<float>* qualityParam = nullptr;
+    std::atomic<float>* voicesParam = nullptr;
+    std::atomic<float>* harmonyParam = nullptr;
+    std::atomic<float>* autoKeyParam = nullptr;
+
+    // Audio-thread scratch memory, reserved in prepareToPlay and rewound at the top of every processBlock
+    ScratchArena scratch;
+    int maxVoiceSamples = 0;
+    int maxTileSamples = 0;
+
+    // Largest downward shift startVoiceGrain() can be asked for: a full octave of note offset, the octave
+    // knob at its minimum, the detune knob and the random tile detune. Sets the longest possible tile.
+    constexpr static float maxDownwardShiftSemitones = 11.0f - minOctave * 12.0f + 1.0f + 0.1f;
+
+    // Grows a buffer's allocation to hold numSamples without changing its current contents or length.
+    static void reserveSamples(juce::AudioBuffer<float>& buffer, int numChannels, int numSamples)
+    {
+        const int currentSamples = buffer.getNumSamples();
+        buffer.setSize(numChannels, juce::jmax(numSamples, currentSamples), true, true, true);
+        buffer.setSize(numChannels, currentSamples, true, false, true);
+    }
+
+    // processBlock hands each block to the core instantiated for the layout's channel count (mono or stereo),
+    // so every per-sample loop beneath it runs over a compile-time number of channels
+    template <int NumChannels> void processBlockFor(juce::AudioBuffer<float>& buffer);
+    using ProcessCore = void (CounterTune_v2AudioProcessor::*)(juce::AudioBuffer<float>&);
+    ProcessCore processCore = &CounterTune_v2AudioProcessor::processBlockFor<2>;
 
     // Timing utilities
 
@@ -137,12 +265,108 @@ private:
     void isolateBestNote();
     void resetTiming();
 
+    // State utilities
+    constexpr static int stateMagic = 0x32765443; // "CTv2"
+    constexpr static int stateVersion = 1;
+    constexpr static int maxStoredVoiceSamples = 1 << 16; // sanity limit on a loaded voice
+    bool compressState = false;
+    double voiceSampleRate = 0.0; // rate the current voice was recorded at
+    void restoreVoice(juce::AudioBuffer<float>& voice, int noteNumber, double sampleRate, const std::vector<int>& melody);
+    void convertVoiceSampleRate(juce::AudioBuffer<float>& voice, double fromRate, double toRate);
+
+    // Analysis worker utilities
+    // The audio thread streams its input and cycle events through analysisQueue to the worker: whichever thread
+    // of the shared AnalysisPool picks up this instance's job. The worker does pitch detection, input capture,
+    // voice extraction and melody generation, and hands results back through triple buffers and atomics, so no
+    // processBlock call does more than a block's worth of work.
+    struct AnalysisMessage
+    {
+        enum class Type { audio, prepareMelody, endCycle, rebuildTiles };
+        constexpr static int maxSamples = 256;
+
+        Type type = Type::audio;
+        juce::int64 startSample = 0; // audio: first sample in the message; endCycle: first sample of the next cycle
+        int numSamples = 0;
+        int numChannels = 0;
+        int key = 0, scale = 1, density = 1; // prepareMelody
+        float samples[2][maxSamples] = {};
+    };
+
+    struct VoiceTile
+    {
+        juce::AudioBuffer<float> samples;
+        int noteNumber = -1;
+        int generation = -1;
+    };
+
+    // This instance's work on the process-wide analysis pool, registered while it plays in real time
+    class AnalysisJob : public AnalysisPool::Client
+    {
+    public:
+        explicit AnalysisJob(CounterTune_v2AudioProcessor& p) : processor(p) {}
+        bool runAnalysis() override { return processor.runAnalysis(); }
+        // A rebuild owed from a mid-swap rides along with the next block's input rather than spinning a thread
+        bool hasWork() const noexcept override { return processor.analysisQueue.getNumReady() > 0; }
+
+    private:
+        CounterTune_v2AudioProcessor& processor;
+    };
+
+    constexpr static int noDetectedNote = std::numeric_limits<int>::min();
+    SpscQueue<AnalysisMessage> analysisQueue;
+    TripleBuffer<VoiceTile> voiceTiles;
+    TripleBuffer<std::vector<int>> melodies;
+    std::atomic<int> analysisRunState{ 0 }; // run generation * 2, plus 1 while the worker is following a note
+    std::atomic<int> latestDetectedNote{ noDetectedNote };
+    int lastAnalysisRunState = 0; // audio thread's copy
+    juce::SharedResourcePointer<AnalysisPool> analysisPool;
+    AnalysisJob analysisJob{ *this };
+
+    // audio thread side
+    template <int NumChannels> void pushInputForAnalysis(const juce::AudioBuffer<float>& buffer, juce::int64 blockStartSample);
+    void pushAnalysisEvent(AnalysisMessage::Type type, juce::int64 startSample);
+    void handOffAnalysis();
+    bool analyseInline = false; // rendering offline: no pool, the audio thread runs the analysis itself
+
+    // worker side (or inline on the audio thread when rendering offline)
+    bool runAnalysis(); // true if there was anything to do
+    void analyseInput(const AnalysisMessage& message);
+    void endAnalysisCycle(juce::int64 nextCycleStartSample);
+    void resetAnalysis();
+    void publishAnalysisState() { analysisRunState.store(analysisGeneration * 2 + (analysisRunning ? 1 : 0)); }
+    bool analysisRunning = false;
+    int analysisGeneration = 0;
+
+    // Tile cache hand-off. The audio thread plays from currentTileCache; the worker builds the other one and
+    // offers it through pendingTileCache, getting the one it replaced back through retiredTileCache.
+    void rebuildTileCache();
+    TileCache tileCaches[2];
+    TileCache* currentTileCache = &tileCaches[0]; // audio thread
+    TileCache* previousTileCache = nullptr; // audio thread: replaced, but grains may still be reading it
+    std::atomic<TileCache*> pendingTileCache{ nullptr };
+    std::atomic<TileCache*> retiredTileCache{ &tileCaches[1] };
+    bool tileCacheDirty = false; // worker: a rebuild is owed but the audio thread was mid-swap, or the knobs moved
+    TileCache::Settings tileSettingsFor(int generation) const noexcept
+    {
+        return { generation, getOctaveInt(), TileCache::quantiseDetune(getDetuneFloat()), getQualityInt() };
+    }
+
+    // Audio thread: the knobs the last rebuild was asked for, so moving one asks for the next
+    void requestTileRebuildOnKnobChange(juce::int64 blockStartSample);
+    TileCache::Settings requestedTileSettings;
+    int requestedTileVoices = -1;
+    int requestedTileHarmony = -1;
+    juce::AudioBuffer<float> cacheVoice; // worker's copy of the voice and melody the cache is built from
+    int cacheVoiceNote = -1;
+    int cacheVoiceGeneration = -1;
+    std::vector<int> cacheMelody = std::vector<int>(32, -2);
+
     // Pitch detection utilities
-    dywapitchtracker pitchTracker;
-    juce::AudioBuffer<float> analysisBuffer{ 1, 1024 };
-    int pitchDetectorFillPos = 0;
-    std::vector<float> detectedFrequencies;
-    std::vector<int> detectedNoteNumbers;
+    PitchAnalyzer pitchAnalyzer;
+    constexpr static int analysisFrameSizeAt44100 = 1024;
+    std::atomic<int> analysisHopSizeAt44100{ 256 };
+    juce::int64 processedSamples = 0; // running sample clock the frame timestamps are measured on
+    NoteRunTracker noteRuns; // frame timestamps are on the processedSamples clock
     inline int frequencyToMidiNote(float frequency)
     {
         if (frequency <= 0.0f)
@@ -152,74 +376,26 @@ private:
         return static_cast<int>(std::round(12.0f * std::log2(frequency / 440.0f) + 69.0f));
     }
 
-    // Audio recording utilities
+    // Audio recording utilities (worker side)
+    // Input is recorded continuously into a ring sized in prepareToPlay for the longest cycle. Sample n of the
+    // processedSamples clock lives at index n & mask, so cycle boundaries are just positions on that clock.
     juce::AudioBuffer<float> inputAudioBuffer;
-    std::atomic<int> inputAudioBuffer_samplesToRecord{ 0 };
-    std::atomic<int> inputAudioBuffer_writePos{ 0 };
+    int inputAudioBuffer_mask = 0;
+    juce::int64 inputAudioBuffer_endSample = 0; // one past the newest recorded sample
+    juce::int64 inputAudioBuffer_cycleStartSample = 0; // where the current cycle's recording begins
 
     // Melody capture utilities
     std::vector<int> capturedMelody = std::vector<int>(32, -1);
 
     // Melody generation utilities
-    void generateMelody();
+    void generateMelody(std::vector<int>& melody, int key, int scale, int density);
+    Scales::ScaleSet scales;
     std::vector<int> generatedMelody = std::vector<int>(32, -2);
 //    std::vector<int> generatedMelody{60, 62, 64, 65, 67, 69, 71, 72, -2, -2, -2, -2, 72, -2, 71, -2, 69, 69, 67, -2, 67, -2, 60, -2, 59, -2, 59, -2, 59, -2, 59, -2 };
     std::vector<int> lastGeneratedMelody = std::vector<int>(32, -1);
-    int detectedKey = 0;
+    KeyDetector keyDetector; // analysis side
+    std::atomic<int> detectedKey{ KeyDetector::noKey };
     
-    inline juce::AudioBuffer<float> pitchShift(const juce::AudioBuffer<float>& input, int baseNote, float interval)
-    {
-        if (input.getNumSamples() == 0 || baseNote < 0)
-        {
-            return juce::AudioBuffer<float>(input.getNumChannels(), 0);
-        }
-
-        float semitoneShift = interval;
-
-        float pitchRatio = std::pow(2.0f, semitoneShift / 12.0f);
-
-        int numChannels = input.getNumChannels();
-        int inputSamples = input.getNumSamples();
-        int outputSamples = static_cast<int>(inputSamples / pitchRatio + 0.5f);
-
-        if (outputSamples <= 0)
-        {
-            return juce::AudioBuffer<float>(numChannels, 0);
-        }
-
-        juce::AudioBuffer<float> output(numChannels, outputSamples);
-
-        // Linear interpolation resampling
-        for (int ch = 0; ch < numChannels; ++ch)
-        {
-            const float* inputData = input.getReadPointer(ch);
-            float* outputData = output.getWritePointer(ch);
-
-            for (int i = 0; i < outputSamples; ++i)
-            {
-                float readPos = i * pitchRatio;
-                int readIndex = static_cast<int>(readPos);
-                float frac = readPos - readIndex;
-
-                if (readIndex < inputSamples - 1)
-                {
-                    // Linear interpolation between samples
-                    outputData[i] = inputData[readIndex] * (1.0f - frac) + inputData[readIndex + 1] * frac;
-                }
-                else if (readIndex < inputSamples)
-                {
-                    outputData[i] = inputData[readIndex];
-                }
-                else
-                {
-                    outputData[i] = 0.0f;
-                }
-            }
-        }
-
-        return output;
-    }
-
     inline void bellCurve(juce::AudioBuffer<float>& input)
     {
         int numSamples = input.getNumSamples();
@@ -235,33 +411,56 @@ private:
         }
     }
 
-    // Audio playback utilities - main voice and synthesis buffers
-    juce::AudioBuffer<float> voiceBuffer;
+    // Audio playback utilities - grain voice
+    // The audio thread keeps its own two copies of the published voice and alternates between them, so a new
+    // voice never lands under a grain that's still reading the last one.
+    juce::AudioBuffer<float> voiceBuffers[2];
+    int voiceBufferIndex = 0;
+    int voiceGeneration = -1;
     std::atomic<int> newVoiceNoteNumber{ -1 };
     std::atomic<int> voiceNoteNumber{ -1 };
-    int randomOffset = 0;
     float randomPitch = 0.0f;
-    juce::AudioBuffer<float> synthesisBuffer;
-    std::atomic<int> synthesisBuffer_readPos{ 0 };
+    GrainPool grains;
+    int startVoiceGrain(int semitoneOffset, int detuneStep, int fadeInLength, int voice = 0, float gain = 1.0f);
+
+    // Harmony voices: each plays its own grain line from the shared voice and tile cache, a fixed interval
+    // above the melody. The grains of a voice carry its index. Voice state is one array per field, and the
+    // spawn countdowns of every voice move on together once per block.
+    std::array<int, maxHarmonyVoices> harmonyLeadGrains;   // most recently started grain, -1 if none
+    std::array<float, maxHarmonyVoices> harmonyUntilSpawn; // output samples until the next grain starts
+    std::array<int, maxHarmonyVoices> harmonyIntervals;    // semitones above the melody note, octaves included
+    std::array<float, maxHarmonyVoices> harmonyGains;
+    int numHarmonyVoices = 0; // playing the current note
+    int harmonyInterval(int note, int voice) const noexcept;
+
+    // The melody plays in the voice's own octave: a note is its pitch class's offset from the voice's, -11 to 11
+    int pitchClassOffsetFor(int note) const noexcept { return (note % 12) - (voiceNoteNumber.load() % 12); }
+
+    // Semitones a tile is shifted by: offset from the voice, octave and detune knobs, then the random tile detune
+    static float tileInterval(int semitoneOffset, int detuneStep, int octave, float detune) noexcept
+    {
+        float interval = static_cast<float>(semitoneOffset) + static_cast<float>(octave) * 12.0f + detune;
+        return detuneStep == TileCache::unshiftedStep ? interval : interval + TileCache::detuneStepToSemitones(detuneStep);
+    }
+    ResamplingEngine resampler; // sinc tables built in prepareToPlay
+    EqualPowerCrossfade tileCrossfade;
     int playbackNote = -1;
     bool playbackNoteActive = false;
     juce::ADSR flicker;
     juce::ADSR::Parameters flickerParams;
     std::atomic<bool> useFlicker{ false };
 
-    // Audio playback utilities - envelope voice and synthesis buffers
-    juce::AudioBuffer<float> r_voiceBuffer;
-    std::atomic<int> r_newVoiceNoteNumber{ -1 };
-    std::atomic<int> r_voiceNoteNumber{ -1 };
-    int r_randomOffset = 0;
-    float r_randomPitch = 0.0f;
-    juce::AudioBuffer<float> r_synthesisBuffer;
-    std::atomic<int> r_synthesisBuffer_readPos{ 0 };
-    int r_playbackNote = -1;
-    bool r_playbackNoteActive = false;
-    juce::ADSR tailEnvelope;
-    juce::ADSR::Parameters tailEnvelopeParams;
-    std::atomic<bool> useTailEnvelope{ false };
+    // UI utilities - published for the editor
+    TripleBuffer<juce::AudioBuffer<float>> uiWaveforms; // written by the analysis worker
+    void publishUiWaveform(const juce::AudioBuffer<float>& voice);
+    std::atomic<std::uint32_t> uiNotes{ 0xffffffffu }; // input and output note as two int16s, so they update together
+    int uiInputNote = -1; // audio thread's working copies
+    int uiOutputNote = -1;
+    void publishUiNotes() noexcept
+    {
+        uiNotes.store(static_cast<std::uint32_t>(static_cast<std::uint16_t>(uiInputNote))
+                    | (static_cast<std::uint32_t>(static_cast<std::uint16_t>(uiOutputNote)) << 16));
+    }
 
     // Output utilities
     juce::dsp::DryWetMixer<float> dryWetMixer;
@@ -271,13 +470,10 @@ private:
     juce::Random rnd;
     std::vector<float> offsetFractions;
     std::vector<float> detuneSemitones;
+    std::vector<int> detuneSteps; // TileCache detune step behind each detuneSemitones entry
     int offsetIndex = 0;
     int detuneIndex = 0;
-
-    std::vector<float> r_offsetFractions;
-    std::vector<float> r_detuneSemitones;
-    int r_offsetIndex = 0;
-    int r_detuneIndex = 0;
+    void fillRandomTables();
 
     constexpr static int tableSize = 512;
 
@@ -287,6 +483,10 @@ private:
     float sustain = 1.0f;  // Gain coefficient
     float release = 0.0f;  // * 2 seconds after note end
 
+   #if COUNTERTUNE_PROFILING
+    StageProfiler stageProfiler;
+   #endif
+
 
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CounterTune_v2AudioProcessor)
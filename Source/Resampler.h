@@ -0,0 +1,379 @@
+// Resampler.h
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <vector>
+
+// Pitch-shift-by-resampling kernels. Nothing here allocates: the caller owns both the source and the
+// destination memory, and a render can be split across several calls (e.g. around a ring-buffer wrap)
+// by passing the returned read phase into the next call.
+struct Resampler
+{
+    // Read-only view of the material being resampled.
+    struct SourceView
+    {
+        const float* const* channels = nullptr;
+        int numChannels = 0;
+        int numSamples = 0;
+    };
+
+    // Caller-owned memory a kernel writes into. Renders never go past capacity.
+    struct DestinationView
+    {
+        float* const* channels = nullptr;
+        int numChannels = 0;
+        int capacity = 0;
+    };
+
+    static SourceView sourceOf(const juce::AudioBuffer<float>& buffer) noexcept
+    {
+        return { buffer.getArrayOfReadPointers(), buffer.getNumChannels(), buffer.getNumSamples() };
+    }
+
+    static DestinationView destinationOf(juce::AudioBuffer<float>& buffer) noexcept
+    {
+        return { buffer.getArrayOfWritePointers(), buffer.getNumChannels(), buffer.getNumSamples() };
+    }
+
+    static float semitonesToRatio(float semitones) noexcept
+    {
+        return std::pow(2.0f, semitones / 12.0f);
+    }
+
+    // Number of output samples a full render of sourceSamples at the given ratio produces.
+    static int getOutputLength(int sourceSamples, double ratio) noexcept
+    {
+        if (sourceSamples <= 0 || ratio <= 0.0)
+            return 0;
+
+        return static_cast<int>(sourceSamples / ratio + 0.5);
+    }
+
+    // Linear-interpolation resample into dest[destOffset, destOffset + numSamples), reading the source
+    // at startPhase + i * ratio. Reads past the end of the source produce silence.
+    // Returns the read phase following the last rendered sample.
+    static double render(const SourceView& source, const DestinationView& dest, int destOffset, int numSamples,
+                         double ratio, double startPhase) noexcept
+    {
+        return renderVectorised(source, dest, destOffset, numSamples, ratio, startPhase);
+    }
+
+    // Scalar reference version of render(), one sample at a time with the bounds checked per sample. The
+    // vectorised path must match it to within 1e-6.
+    static double renderReference(const SourceView& source, const DestinationView& dest, int destOffset, int numSamples,
+                                  double ratio, double startPhase) noexcept
+    {
+        numSamples = clampToCapacity(dest, destOffset, numSamples);
+
+        for (int ch = 0; ch < juce::jmin(source.numChannels, dest.numChannels); ++ch)
+        {
+            const float* in = source.channels[ch];
+            float* out = dest.channels[ch] + destOffset;
+
+            for (int i = 0; i < numSamples; ++i)
+                out[i] = interpolate(in, source.numSamples, startPhase + i * ratio);
+        }
+
+        return startPhase + numSamples * ratio;
+    }
+
+private:
+    static constexpr int chunkSize = 128;
+
+    // Outputs [0, count) all read two valid source samples; only the tail past it needs the
+    // end-of-source handling, so the vector loop runs without any per-sample bounds checks.
+    static int countInterpolable(int inputSamples, int numSamples, double ratio, double startPhase) noexcept
+    {
+        jassert(ratio > 0.0 && startPhase >= 0.0);
+
+        auto readIndexAt = [&](int i) { return static_cast<int>(startPhase + i * ratio); };
+
+        int count = juce::jlimit(0, numSamples, static_cast<int>(std::ceil((inputSamples - 1 - startPhase) / ratio)));
+        while (count > 0 && readIndexAt(count - 1) >= inputSamples - 1) --count;
+        while (count < numSamples && readIndexAt(count) < inputSamples - 1) ++count;
+        return count;
+    }
+
+    // Works a chunk at a time. The read indices and weights come from double read positions, which a float
+    // register can't hold, so they're worked out per sample; each channel then loads the two samples either
+    // side of every read position into contiguous arrays, and the interpolation runs over those in SIMD
+    // registers. It's the same sums as the reference, in the same order.
+    static double renderVectorised(const SourceView& source, const DestinationView& dest, int destOffset, int numSamples,
+                                   double ratio, double startPhase) noexcept
+    {
+        numSamples = clampToCapacity(dest, destOffset, numSamples);
+
+        const int numChannels = juce::jmin(source.numChannels, dest.numChannels);
+        const int interpolable = countInterpolable(source.numSamples, numSamples, ratio, startPhase);
+
+        int indices[chunkSize];
+        alignas(laneAlignment) float loWeights[chunkSize], hiWeights[chunkSize];
+        alignas(laneAlignment) float lo[chunkSize], hi[chunkSize], mixed[chunkSize];
+
+        for (int i = 0; i < interpolable; i += chunkSize)
+        {
+            const int n = juce::jmin(chunkSize, interpolable - i);
+            const int padded = (n + laneWidth - 1) / laneWidth * laneWidth; // the last register's spare lanes mix silence
+
+            // Read positions are shared by every channel
+            for (int k = 0; k < n; ++k)
+            {
+                const double readPos = startPhase + (i + k) * ratio;
+                const int index = static_cast<int>(readPos);
+                const float frac = static_cast<float>(readPos - index);
+                indices[k] = index;
+                loWeights[k] = 1.0f - frac;
+                hiWeights[k] = frac;
+            }
+            for (int k = n; k < padded; ++k)
+            {
+                loWeights[k] = hiWeights[k] = 0.0f;
+                lo[k] = hi[k] = 0.0f;
+            }
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                const float* in = source.channels[ch];
+
+                // The only scalar part: the read positions aren't contiguous
+                for (int k = 0; k < n; ++k)
+                {
+                    lo[k] = in[indices[k]];
+                    hi[k] = in[indices[k] + 1];
+                }
+
+                interpolateChunk(lo, hi, loWeights, hiWeights, mixed, padded);
+                juce::FloatVectorOperations::copy(dest.channels[ch] + destOffset + i, mixed, n);
+            }
+        }
+
+        // The end of the source, one sample at a time
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            const float* in = source.channels[ch];
+            float* out = dest.channels[ch] + destOffset;
+
+            for (int j = interpolable; j < numSamples; ++j)
+                out[j] = interpolate(in, source.numSamples, startPhase + j * ratio);
+        }
+
+        return startPhase + numSamples * ratio;
+    }
+
+   #if JUCE_USE_SIMD
+    using Lanes = juce::dsp::SIMDRegister<float>;
+    static constexpr int laneWidth = static_cast<int>(Lanes::SIMDNumElements);
+    static constexpr size_t laneAlignment = Lanes::SIMDRegisterSize;
+   #else
+    static constexpr int laneWidth = 1;
+    static constexpr size_t laneAlignment = alignof(float);
+   #endif
+    static_assert(chunkSize % laneWidth == 0, "chunks fill whole registers");
+
+    // mixed = lo * loWeights + hi * hiWeights. All the arrays are register-aligned and numSamples is a whole
+    // number of registers.
+    static void interpolateChunk(const float* lo, const float* hi, const float* loWeights, const float* hiWeights,
+                                 float* mixed, int numSamples) noexcept
+    {
+       #if JUCE_USE_SIMD
+        for (int k = 0; k < numSamples; k += laneWidth)
+        {
+            (Lanes::fromRawArray(lo + k) * Lanes::fromRawArray(loWeights + k)
+               + Lanes::fromRawArray(hi + k) * Lanes::fromRawArray(hiWeights + k)).copyToRawArray(mixed + k);
+        }
+       #else
+        for (int k = 0; k < numSamples; ++k)
+            mixed[k] = lo[k] * loWeights[k] + hi[k] * hiWeights[k];
+       #endif
+    }
+
+    static inline float interpolate(const float* in, int inputSamples, double readPos) noexcept
+    {
+        int readIndex = static_cast<int>(readPos);
+        float frac = static_cast<float>(readPos - readIndex);
+
+        if (readIndex < inputSamples - 1)
+        {
+            // Linear interpolation between samples
+            return in[readIndex] * (1.0f - frac) + in[readIndex + 1] * frac;
+        }
+        else if (readIndex < inputSamples)
+        {
+            return in[readIndex];
+        }
+
+        return 0.0f;
+    }
+
+    static int clampToCapacity(const DestinationView& dest, int destOffset, int numSamples) noexcept
+    {
+        jassert(destOffset >= 0 && destOffset + numSamples <= dest.capacity);
+        return juce::jlimit(0, juce::jmax(0, dest.capacity - destOffset), numSamples);
+    }
+};
+
+// Band-limited resampler: Kaiser-windowed sinc evaluated from a table precomputed in prepare().
+// When pitching up (ratio > 1) the kernel is stretched so its cutoff follows the new Nyquist. Its width
+// stops growing at maxKernelStretch times the unstretched one: past that ratio the same number of taps
+// covers fewer sinc lobes, under a window narrowed to fit, so the cutoff stays right and the cost per
+// output sample stays bounded at the price of a wider transition band.
+class SincResampler
+{
+public:
+    SincResampler() = default;
+
+    // Message thread only.
+    void prepare(int numHalfTaps, int numPhasesPerZeroCrossing, double kaiserBeta)
+    {
+        halfTaps = numHalfTaps;
+        phasesPerZeroCrossing = numPhasesPerZeroCrossing;
+
+        const int tableLength = halfTaps * phasesPerZeroCrossing;
+        table.assign(static_cast<size_t>(tableLength + 2), 0.0f);
+        sincTable.assign(static_cast<size_t>(tableLength + 2), 0.0f);
+        windowTable.assign(static_cast<size_t>(tableLength + 2), 0.0f);
+
+        // The windowed kernel, plus its two factors for kernels too stretched to use it whole
+        const double windowNorm = besselI0(kaiserBeta);
+        for (int i = 0; i <= tableLength; ++i)
+        {
+            const double x = static_cast<double>(i) / phasesPerZeroCrossing;
+            const double sinc = i == 0 ? 1.0 : std::sin(juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+            const double r = x / halfTaps;
+            const double window = besselI0(kaiserBeta * std::sqrt(juce::jmax(0.0, 1.0 - r * r))) / windowNorm;
+            table[static_cast<size_t>(i)] = static_cast<float>(sinc * window);
+            sincTable[static_cast<size_t>(i)] = static_cast<float>(sinc);
+            windowTable[static_cast<size_t>(i)] = static_cast<float>(window);
+        }
+    }
+
+    bool isPrepared() const noexcept { return ! table.empty(); }
+
+    double render(const Resampler::SourceView& source, const Resampler::DestinationView& dest, int destOffset, int numSamples,
+                  double ratio, double startPhase) const noexcept
+    {
+        return process(source, dest, destOffset, numSamples, ratio, startPhase);
+    }
+
+private:
+    static constexpr int maxChannels = 2;
+    static constexpr int maxKernelStretch = 4; // widest kernel, relative to the unstretched one
+
+    double process(const Resampler::SourceView& source, const Resampler::DestinationView& dest, int destOffset, int numSamples,
+                   double ratio, double startPhase) const noexcept
+    {
+        jassert(isPrepared() && ratio > 0.0);
+        jassert(destOffset >= 0 && destOffset + numSamples <= dest.capacity);
+        numSamples = juce::jlimit(0, juce::jmax(0, dest.capacity - destOffset), numSamples);
+
+        const int numChannels = juce::jmin(source.numChannels, dest.numChannels, maxChannels);
+        const double cutoff = ratio > 1.0 ? 1.0 / ratio : 1.0;
+        const double support = juce::jmin(halfTaps / cutoff, static_cast<double>(halfTaps * maxKernelStretch));
+        const bool narrowed = halfTaps / cutoff > support;
+        const double tableScale = cutoff * phasesPerZeroCrossing;
+        const int tableLimit = halfTaps * phasesPerZeroCrossing;
+        const double windowScale = tableLimit / support;
+        const float gain = static_cast<float>(cutoff);
+        const float* coefficients = table.data();
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const double readPos = startPhase + i * ratio;
+            const int first = juce::jmax(0, static_cast<int>(std::floor(readPos - support)) + 1);
+            const int last = juce::jmin(source.numSamples - 1, static_cast<int>(std::floor(readPos + support)));
+
+            float sum[maxChannels] = {};
+            for (int j = first; j <= last; ++j)
+            {
+                const double distance = std::abs(readPos - j);
+                const double tablePos = distance * tableScale;
+                const int t = static_cast<int>(tablePos);
+                if (t > tableLimit)
+                    continue;
+
+                const float frac = static_cast<float>(tablePos - t);
+                float c = 0.0f;
+                if (narrowed)
+                {
+                    const double windowPos = distance * windowScale;
+                    const int w = static_cast<int>(windowPos);
+                    if (w > tableLimit)
+                        continue;
+
+                    const float windowFrac = static_cast<float>(windowPos - w);
+                    c = (sincTable[static_cast<size_t>(t)] + (sincTable[static_cast<size_t>(t + 1)] - sincTable[static_cast<size_t>(t)]) * frac)
+                      * (windowTable[static_cast<size_t>(w)] + (windowTable[static_cast<size_t>(w + 1)] - windowTable[static_cast<size_t>(w)]) * windowFrac);
+                }
+                else
+                {
+                    c = coefficients[t] + (coefficients[t + 1] - coefficients[t]) * frac;
+                }
+
+                for (int ch = 0; ch < numChannels; ++ch)
+                    sum[ch] += source.channels[ch][j] * c;
+            }
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                dest.channels[ch][destOffset + i] = sum[ch] * gain;
+        }
+
+        return startPhase + numSamples * ratio;
+    }
+
+    // Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+    static double besselI0(double x) noexcept
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 50; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1.0e-12)
+                break;
+        }
+        return sum;
+    }
+
+    int halfTaps = 0;
+    int phasesPerZeroCrossing = 0;
+    std::vector<float> table;
+    std::vector<float> sincTable, windowTable;
+
+    JUCE_DECLARE_NON_COPYABLE(SincResampler)
+};
+
+// Picks the kernel for a quality tier: draft is the vectorised linear interpolator, normal and high
+// are windowed-sinc kernels whose tables are built once in prepare().
+class ResamplingEngine
+{
+public:
+    enum class Quality { draft = 0, normal, high };
+
+    ResamplingEngine() = default;
+
+    // Message thread only.
+    void prepare()
+    {
+        if (! normal.isPrepared()) normal.prepare(8, 256, 8.0);
+        if (! high.isPrepared())   high.prepare(16, 512, 10.0);
+    }
+
+    double render(Quality quality, const Resampler::SourceView& source, const Resampler::DestinationView& dest, int destOffset,
+                  int numSamples, double ratio, double startPhase) const noexcept
+    {
+        switch (quality)
+        {
+            case Quality::normal: return normal.render(source, dest, destOffset, numSamples, ratio, startPhase);
+            case Quality::high:   return high.render(source, dest, destOffset, numSamples, ratio, startPhase);
+            case Quality::draft:  break;
+        }
+
+        return Resampler::render(source, dest, destOffset, numSamples, ratio, startPhase);
+    }
+
+private:
+    SincResampler normal, high;
+
+    JUCE_DECLARE_NON_COPYABLE(ResamplingEngine)
+};
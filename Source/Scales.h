@@ -0,0 +1,197 @@
+// Scales.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Scales as 12-bit pitch-class masks: bit n set means the scale has the note n semitones above the root.
+// The degrees of every possible mask are worked out at compile time, so looking up a scale's notes is one
+// table read whatever scale it is, built in or user-defined, and nothing on the way allocates.
+namespace Scales
+{
+    using Mask = juce::uint16;
+
+    constexpr Mask maskOf(std::initializer_list<int> semitones)
+    {
+        Mask mask = 0;
+        for (int semitone : semitones)
+            mask = static_cast<Mask>(mask | (1 << (semitone % 12)));
+        return mask;
+    }
+
+    struct Degrees
+    {
+        std::array<juce::int8, 12> semitones{}; // above the root, ascending
+        int size = 0;
+    };
+
+    constexpr Degrees degreesOf(Mask mask)
+    {
+        Degrees degrees;
+        for (int semitone = 0; semitone < 12; ++semitone)
+        {
+            if ((mask >> semitone) & 1)
+                degrees.semitones[static_cast<size_t>(degrees.size++)] = static_cast<juce::int8>(semitone);
+        }
+        return degrees;
+    }
+
+    inline constexpr auto degreeTable = []
+    {
+        std::array<Degrees, 4096> table{};
+        for (int mask = 0; mask < 4096; ++mask)
+            table[static_cast<size_t>(mask)] = degreesOf(static_cast<Mask>(mask));
+        return table;
+    }();
+
+    struct Scale
+    {
+        const char* name;
+        Mask mask;
+    };
+
+    // The first four keep the scale parameter's original numbering
+    inline constexpr Scale builtIn[] = {
+        { "Major",            maskOf({ 0, 2, 4, 5, 7, 9, 11 }) },
+        { "Harmonic Major",   maskOf({ 0, 2, 4, 5, 7, 8, 11 }) },
+        { "Pentatonic",       maskOf({ 0, 2, 4, 7, 9 }) },
+        { "Chromatic",        0xfff },
+        { "Natural Minor",    maskOf({ 0, 2, 3, 5, 7, 8, 10 }) },
+        { "Harmonic Minor",   maskOf({ 0, 2, 3, 5, 7, 8, 11 }) },
+        { "Melodic Minor",    maskOf({ 0, 2, 3, 5, 7, 9, 11 }) },
+        { "Dorian",           maskOf({ 0, 2, 3, 5, 7, 9, 10 }) },
+        { "Phrygian",         maskOf({ 0, 1, 3, 5, 7, 8, 10 }) },
+        { "Lydian",           maskOf({ 0, 2, 4, 6, 7, 9, 11 }) },
+        { "Mixolydian",       maskOf({ 0, 2, 4, 5, 7, 9, 10 }) },
+        { "Locrian",          maskOf({ 0, 1, 3, 5, 6, 8, 10 }) },
+        { "Minor Pentatonic", maskOf({ 0, 3, 5, 7, 10 }) },
+        { "Blues",            maskOf({ 0, 3, 5, 6, 7, 10 }) },
+        { "Whole Tone",       maskOf({ 0, 2, 4, 6, 8, 10 }) },
+    };
+
+    constexpr int majorScale = 1, naturalMinorScale = 5; // scale parameter numbers
+
+    constexpr int numBuiltIn = static_cast<int>(std::size(builtIn));
+    constexpr int maxUserScales = 8;
+    constexpr int numScales = numBuiltIn + maxUserScales;
+
+    // The built-in scales followed by up to maxUserScales loaded ones, numbered from 1 like the scale parameter.
+    // Masks are atomics, so any thread can read while the message thread loads new user scales.
+    class ScaleSet
+    {
+    public:
+        ScaleSet()
+        {
+            for (int i = 0; i < numScales; ++i)
+                masks[static_cast<size_t>(i)].store(i < numBuiltIn ? builtIn[i].mask : 0);
+        }
+
+        // Any thread. Scale numbers past getNumScales() aren't in use; callers clamp to it, and an empty slot
+        // asked for anyway plays as the first scale.
+        Mask getMask(int scaleNumber) const noexcept
+        {
+            const auto mask = masks[static_cast<size_t>(juce::jlimit(1, numScales, scaleNumber) - 1)].load(std::memory_order_relaxed);
+            return mask != 0 ? mask : builtIn[0].mask;
+        }
+
+        const Degrees& getDegrees(int scaleNumber) const noexcept { return degreeTable[getMask(scaleNumber)]; }
+
+        // Any thread: the built-in scales plus the user scales loaded, so the highest scale number in use.
+        int getNumScales() const noexcept { return numBuiltIn + numUserScales.load(std::memory_order_relaxed); }
+
+        // Message thread only from here on.
+        juce::String getName(int scaleNumber) const
+        {
+            const int index = juce::jlimit(1, numScales, scaleNumber) - 1;
+            return index < numBuiltIn ? juce::String(builtIn[index].name) : userNames[index - numBuiltIn];
+        }
+
+        void clearUserScales()
+        {
+            for (int i = numBuiltIn; i < numScales; ++i)
+                masks[static_cast<size_t>(i)].store(0);
+            userNames.clear();
+            numUserScales.store(0);
+        }
+
+        // Adds a user scale in the next free slot; false if they're all taken or the mask is empty.
+        bool addUserScale(const juce::String& name, Mask mask)
+        {
+            if (userNames.size() >= maxUserScales || (mask & 0xfff) == 0)
+                return false;
+
+            masks[static_cast<size_t>(numBuiltIn + userNames.size())].store(static_cast<Mask>(mask & 0xfff));
+            userNames.add(name);
+            numUserScales.store(userNames.size());
+            return true;
+        }
+
+        int getNumUserScales() const noexcept { return userNames.size(); }
+
+        // Parses user scales, one "<name> = <semitones above the root>" per line, e.g. "Hijaz = 0 1 4 5 7 8 10".
+        // # starts a comment. Replaces the current user scales; returns an error message, or an empty string.
+        juce::String parseUserScales(const juce::String& text)
+        {
+            clearUserScales();
+
+            juce::StringArray lines;
+            lines.addLines(text);
+            for (int i = 0; i < lines.size(); ++i)
+            {
+                const auto line = lines[i].upToFirstOccurrenceOf("#", false, false).trim();
+                if (line.isEmpty())
+                    continue;
+
+                const auto name = line.upToFirstOccurrenceOf("=", false, false).trim();
+                juce::StringArray semitones;
+                semitones.addTokens(line.fromFirstOccurrenceOf("=", false, false), " ,\t", "");
+                semitones.removeEmptyStrings();
+
+                Mask mask = 0;
+                for (const auto& semitone : semitones)
+                {
+                    if (!semitone.containsOnly("0123456789") || semitone.getIntValue() > 11)
+                        return "line " + juce::String(i + 1) + ": semitones must be 0 to 11";
+                    mask = static_cast<Mask>(mask | (1 << semitone.getIntValue()));
+                }
+
+                if (name.isEmpty() || !line.containsChar('='))
+                    return "line " + juce::String(i + 1) + ": expected <name> = <semitones>";
+                if (!addUserScale(name, mask))
+                    return "line " + juce::String(i + 1) + ": no notes, or more than " + juce::String(maxUserScales) + " scales";
+            }
+            return {};
+        }
+
+        // User scales as a child of the plugin state, so they travel with the session.
+        juce::ValueTree toValueTree() const
+        {
+            juce::ValueTree tree("UserScales");
+            for (int i = 0; i < userNames.size(); ++i)
+            {
+                juce::ValueTree scale("Scale");
+                scale.setProperty("name", userNames[i], nullptr);
+                scale.setProperty("mask", static_cast<int>(masks[static_cast<size_t>(numBuiltIn + i)].load()), nullptr);
+                tree.appendChild(scale, nullptr);
+            }
+            return tree;
+        }
+
+        void fromValueTree(const juce::ValueTree& tree)
+        {
+            clearUserScales();
+            for (int i = 0; i < tree.getNumChildren(); ++i)
+            {
+                const auto scale = tree.getChild(i);
+                addUserScale(scale.getProperty("name").toString(), static_cast<Mask>(static_cast<int>(scale.getProperty("mask"))));
+            }
+        }
+
+    private:
+        std::array<std::atomic<Mask>, numScales> masks;
+        juce::StringArray userNames;
+        std::atomic<int> numUserScales{ 0 };
+
+        JUCE_DECLARE_NON_COPYABLE(ScaleSet)
+    };
+}
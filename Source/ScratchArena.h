@@ -0,0 +1,70 @@
+// ScratchArena.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Bump allocator for audio-thread temporaries. Memory is reserved once on the message thread
+// (prepareToPlay) and handed out / rewound on the audio thread without ever touching the heap.
+class ScratchArena
+{
+public:
+    static constexpr size_t alignment = 32;
+
+    ScratchArena() = default;
+
+    // Message thread only.
+    void reserve(size_t numBytes)
+    {
+        if (numBytes > capacity)
+        {
+            storage.allocate(numBytes + alignment, true);
+            auto address = reinterpret_cast<std::uintptr_t>(storage.get());
+            base = storage.get() + ((alignment - (address & (alignment - 1))) & (alignment - 1));
+            capacity = numBytes;
+        }
+        offset = 0;
+    }
+
+    // Rewinds everything handed out so far. Call at the top of processBlock.
+    void reset() noexcept { offset = 0; }
+
+    size_t getCapacity() const noexcept { return capacity; }
+    size_t getBytesInUse() const noexcept { return offset; }
+
+    // Returns nullptr (and asserts) if the request doesn't fit; callers must skip the work
+    // rather than fall back to the heap.
+    template <typename T>
+    T* allocate(int numElements) noexcept
+    {
+        jassert(numElements >= 0);
+        auto bytes = roundUp(sizeof(T) * static_cast<size_t>(numElements));
+
+        if (base == nullptr || offset + bytes > capacity)
+        {
+            jassertfalse; // arena too small - size it in prepareToPlay
+            return nullptr;
+        }
+
+        auto* result = reinterpret_cast<T*>(base + offset);
+        offset += bytes;
+        return result;
+    }
+
+    // Bytes needed by allocate<T>(numElements), including alignment padding; use when sizing reserve().
+    template <typename T>
+    static size_t bytesFor(int numElements) noexcept
+    {
+        return roundUp(sizeof(T) * static_cast<size_t>(numElements));
+    }
+
+private:
+    static constexpr size_t roundUp(size_t bytes) noexcept { return (bytes + alignment - 1) & ~(alignment - 1); }
+
+    juce::HeapBlock<char> storage;
+    char* base = nullptr;
+    size_t capacity = 0;
+    size_t offset = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(ScratchArena)
+};
@@ -0,0 +1,51 @@
+// SpscQueue.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Single-producer / single-consumer queue of fixed-size records on top of juce::AbstractFifo.
+// Storage is allocated in prepare() on the message thread; after that neither side blocks or
+// allocates. Records are filled and read in place, so large ones are never copied.
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue() = default;
+
+    // Message thread only, with neither side running.
+    void prepare(int capacity)
+    {
+        storage.resize(static_cast<size_t>(capacity) + 1);
+        fifo.setTotalSize(capacity + 1);
+        fifo.reset();
+    }
+
+    // Producer: a slot to fill, or nullptr if the queue is full. Call finishPush() once it's filled.
+    T* beginPush() noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        return size1 > 0 ? &storage[static_cast<size_t>(start1)] : nullptr;
+    }
+
+    void finishPush() noexcept { fifo.finishedWrite(1); }
+
+    // Consumer: the oldest record, or nullptr if the queue is empty. Call pop() when done with it.
+    T* front() noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(1, start1, size1, start2, size2);
+        return size1 > 0 ? &storage[static_cast<size_t>(start1)] : nullptr;
+    }
+
+    void pop() noexcept { fifo.finishedRead(1); }
+
+    int getNumReady() const noexcept { return fifo.getNumReady(); }
+
+private:
+    juce::AbstractFifo fifo{ 2 };
+    std::vector<T> storage = std::vector<T>(2);
+
+    JUCE_DECLARE_NON_COPYABLE(SpscQueue)
+};
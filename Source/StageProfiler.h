@@ -0,0 +1,185 @@
+// StageProfiler.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Timing probes around the stages of processBlock. Each stage's time is taken as a percentage of the
+// block's real-time budget (numSamples / sampleRate) and counted into a histogram, from which any thread
+// can read mean, p99 and max while the audio thread keeps writing. The audio thread is the only writer,
+// so recording is plain relaxed loads and stores: no locks, no read-modify-write, no allocation.
+// Define COUNTERTUNE_DISABLE_PROFILING to compile the probes and the class out entirely.
+
+#if ! defined (COUNTERTUNE_DISABLE_PROFILING)
+ #define COUNTERTUNE_PROFILING 1
+#else
+ #define COUNTERTUNE_PROFILING 0
+#endif
+
+#if COUNTERTUNE_PROFILING
+
+class StageProfiler
+{
+public:
+    enum Stage
+    {
+        wholeBlock = 0,
+        analysisHandOff,  // queueing input for the worker (and running it inline when offline)
+        voiceHandOff,     // picking up run state, voice and tile cache from the worker
+        sequencing,       // transcription and note-start steps
+        cycleEnd,         // the cycle-boundary block only
+        synthesis,        // envelope, grain mixing and spawning
+        output,           // limiter, gain and dry/wet mix
+        numStages
+    };
+
+    static constexpr int binsPerPercent = 4;
+    static constexpr int maxPercent = 200; // the last bin counts everything from here up
+    static constexpr int numBins = maxPercent * binsPerPercent + 1;
+
+    static const char* getStageName(int stage) noexcept
+    {
+        static const char* const names[] = { "block", "analysis hand-off", "voice hand-off", "sequencing", "cycle end", "synthesis", "output" };
+        return juce::isPositiveAndBelow(stage, static_cast<int>(numStages)) ? names[stage] : "";
+    }
+
+    StageProfiler() = default;
+
+    // Audio thread: call first thing in processBlock.
+    void beginBlock(int numSamples, double sampleRate) noexcept
+    {
+        if (resetRequested.exchange(false, std::memory_order_acquire))
+            clearHistograms();
+
+        budgetTicks = sampleRate > 0.0 ? numSamples / sampleRate * ticksPerSecond : 0.0;
+    }
+
+    void begin(Stage stage) noexcept { startTicks[stage] = juce::Time::getHighResolutionTicks(); }
+    void end(Stage stage) noexcept { record(stage, juce::Time::getHighResolutionTicks() - startTicks[stage]); }
+
+    struct ScopedStage
+    {
+        ScopedStage(StageProfiler& p, Stage s) noexcept : profiler(p), stage(s) { profiler.begin(stage); }
+        ~ScopedStage() noexcept { profiler.end(stage); }
+
+        StageProfiler& profiler;
+        const Stage stage;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedStage)
+    };
+
+    // Any thread. Percentages are of the block's real-time budget; count is the number of blocks the stage ran in.
+    struct Summary
+    {
+        juce::uint32 count = 0;
+        double meanPercent = 0.0;
+        double p99Percent = 0.0;
+        double maxPercent = 0.0;
+    };
+
+    Summary getSummary(int stage) const noexcept
+    {
+        const auto& histogram = histograms[static_cast<size_t>(stage)];
+        Summary summary;
+        summary.count = histogram.count.load(std::memory_order_relaxed);
+        if (summary.count == 0)
+            return summary;
+
+        summary.meanPercent = histogram.sumPercent.load(std::memory_order_relaxed) / summary.count;
+        summary.maxPercent = histogram.maxPercent.load(std::memory_order_relaxed);
+
+        // Upper edge of the bin the 99th percentile falls in
+        const auto target = static_cast<juce::uint64>(std::ceil(summary.count * 0.99));
+        juce::uint64 seen = 0;
+        for (int bin = 0; bin < numBins; ++bin)
+        {
+            seen += histogram.bins[static_cast<size_t>(bin)].load(std::memory_order_relaxed);
+            if (seen >= target)
+            {
+                summary.p99Percent = juce::jmin(static_cast<double>(bin + 1) / binsPerPercent, summary.maxPercent);
+                break;
+            }
+        }
+        return summary;
+    }
+
+    // Clears every histogram at the start of the next block.
+    void reset() noexcept { resetRequested.store(true, std::memory_order_release); }
+
+    juce::String toJson() const
+    {
+        juce::DynamicObject::Ptr stages = new juce::DynamicObject();
+        for (int stage = 0; stage < numStages; ++stage)
+        {
+            const auto summary = getSummary(stage);
+            juce::DynamicObject::Ptr entry = new juce::DynamicObject();
+            entry->setProperty("blocks", static_cast<int>(summary.count));
+            entry->setProperty("mean_percent", summary.meanPercent);
+            entry->setProperty("p99_percent", summary.p99Percent);
+            entry->setProperty("max_percent", summary.maxPercent);
+            stages->setProperty(getStageName(stage), juce::var(entry.get()));
+        }
+        return juce::JSON::toString(juce::var(stages.get()));
+    }
+
+    bool dumpToFile(const juce::File& file) const { return file.replaceWithText(toJson()); }
+
+private:
+    struct Histogram
+    {
+        std::array<std::atomic<juce::uint32>, numBins> bins{};
+        std::atomic<juce::uint32> count{ 0 };
+        std::atomic<double> sumPercent{ 0.0 };
+        std::atomic<double> maxPercent{ 0.0 };
+    };
+
+    void record(Stage stage, juce::int64 ticks) noexcept
+    {
+        if (budgetTicks <= 0.0)
+            return;
+
+        const double percent = static_cast<double>(ticks) * 100.0 / budgetTicks;
+        auto& histogram = histograms[static_cast<size_t>(stage)];
+        auto& bin = histogram.bins[static_cast<size_t>(juce::jlimit(0, numBins - 1, static_cast<int>(percent * binsPerPercent)))];
+
+        bin.store(bin.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        histogram.sumPercent.store(histogram.sumPercent.load(std::memory_order_relaxed) + percent, std::memory_order_relaxed);
+        if (percent > histogram.maxPercent.load(std::memory_order_relaxed))
+            histogram.maxPercent.store(percent, std::memory_order_relaxed);
+        histogram.count.store(histogram.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void clearHistograms() noexcept
+    {
+        for (auto& histogram : histograms)
+        {
+            for (auto& bin : histogram.bins)
+                bin.store(0, std::memory_order_relaxed);
+            histogram.count.store(0, std::memory_order_relaxed);
+            histogram.sumPercent.store(0.0, std::memory_order_relaxed);
+            histogram.maxPercent.store(0.0, std::memory_order_relaxed);
+        }
+    }
+
+    const double ticksPerSecond = static_cast<double>(juce::Time::getHighResolutionTicksPerSecond());
+    double budgetTicks = 0.0;
+    std::array<juce::int64, numStages> startTicks{};
+    std::array<Histogram, numStages> histograms;
+    std::atomic<bool> resetRequested{ false };
+
+    JUCE_DECLARE_NON_COPYABLE(StageProfiler)
+};
+
+ #define COUNTERTUNE_PROFILE_BLOCK(profiler, numSamples, sampleRate) (profiler).beginBlock(numSamples, sampleRate)
+ #define COUNTERTUNE_SCOPED_STAGE(profiler, stage) StageProfiler::ScopedStage JUCE_JOIN_MACRO(stageProbe, __LINE__)(profiler, StageProfiler::stage)
+ #define COUNTERTUNE_STAGE_BEGIN(profiler, stage) (profiler).begin(StageProfiler::stage)
+ #define COUNTERTUNE_STAGE_END(profiler, stage) (profiler).end(StageProfiler::stage)
+
+#else
+
+ #define COUNTERTUNE_PROFILE_BLOCK(profiler, numSamples, sampleRate)
+ #define COUNTERTUNE_SCOPED_STAGE(profiler, stage)
+ #define COUNTERTUNE_STAGE_BEGIN(profiler, stage)
+ #define COUNTERTUNE_STAGE_END(profiler, stage)
+
+#endif
@@ -0,0 +1,139 @@
+// TileCache.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Pre-pitched copies of the current voice, one per (semitone offset, detune step) the next melody can ask
+// for. Built off the audio thread into storage sized for the tiles it holds and handed over whole, so spawning
+// a tile copies finished samples instead of resampling. A tile that didn't fit, or a cache built for other
+// knob settings, is just a miss and the caller renders the tile itself.
+class TileCache
+{
+public:
+    static constexpr int minSemitoneOffset = -11;                        // a pitch class below the voice ...
+    static constexpr int maxSemitoneOffset = 35;                         // ... to one above, plus two octaves of harmony
+    static constexpr int numSemitoneOffsets = maxSemitoneOffset - minSemitoneOffset + 1;
+    static constexpr int numRandomDetuneSteps = 21;                      // -0.10 ... +0.10 semitones
+    static constexpr int unshiftedStep = numRandomDetuneSteps;           // first tile of a step: no random detune
+    static constexpr int numDetuneSteps = numRandomDetuneSteps + 1;
+
+    static constexpr float detuneResolution = 0.01f;                     // semitones between tile pitches
+
+    static float detuneStepToSemitones(int step) noexcept
+    {
+        return step < numRandomDetuneSteps ? (step * detuneResolution) - 0.10f : 0.0f;
+    }
+
+    // The detune knob as the tiles are built for it: rounded to the tile resolution, so a small move of the
+    // knob still finds the cache it was built for.
+    static float quantiseDetune(float semitones) noexcept
+    {
+        return std::round(semitones / detuneResolution) * detuneResolution;
+    }
+
+    // Everything besides the key that a tile's samples depend on, detune already quantised.
+    struct Settings
+    {
+        int voiceGeneration = -1;
+        int octave = 0;
+        float detune = 0.0f;
+        int quality = 0;
+
+        bool operator== (const Settings& other) const noexcept
+        {
+            return voiceGeneration == other.voiceGeneration && octave == other.octave
+                && detune == other.detune && quality == other.quality;
+        }
+    };
+
+    struct Tile
+    {
+        float* channels[2] = {};
+        int numChannels = 0;
+        int numSamples = 0;
+
+        bool isValid() const noexcept { return numSamples > 0; }
+    };
+
+    TileCache() = default;
+
+    // Message thread only.
+    void prepare(int numChannels, int capacitySamples)
+    {
+        storage.setSize(juce::jmin(numChannels, 2), capacitySamples);
+        clear({});
+    }
+
+    // Builder side, on a cache the audio thread isn't reading: makes room for capacitySamples per channel,
+    // reallocating only to grow. Growing drops the samples of tiles already there, so call it before allocating.
+    void reserve(int numChannels, int capacitySamples)
+    {
+        numChannels = juce::jmin(numChannels, 2);
+        if (capacitySamples > storage.getNumSamples() || numChannels != storage.getNumChannels())
+            storage.setSize(numChannels, juce::jmax(capacitySamples, storage.getNumSamples()), false, false, true);
+    }
+
+    void clear(const Settings& newSettings) noexcept
+    {
+        settings = newSettings;
+        used = 0;
+        entries.fill({});
+    }
+
+    const Settings& getSettings() const noexcept { return settings; }
+
+    Tile find(int semitoneOffset, int detuneStep) const noexcept
+    {
+        const int index = indexOf(semitoneOffset, detuneStep);
+        if (index < 0 || entries[static_cast<size_t>(index)].length == 0)
+            return {};
+
+        return tileAt(entries[static_cast<size_t>(index)]);
+    }
+
+    // Reserves space for a tile under the given key; an invalid Tile if the key is out of range or it won't fit.
+    Tile allocate(int semitoneOffset, int detuneStep, int numSamples) noexcept
+    {
+        const int index = indexOf(semitoneOffset, detuneStep);
+        if (index < 0 || numSamples <= 0 || used + numSamples > storage.getNumSamples())
+            return {};
+
+        auto& entry = entries[static_cast<size_t>(index)];
+        entry = { used, numSamples };
+        used += numSamples;
+        return tileAt(entry);
+    }
+
+private:
+    struct Entry
+    {
+        int start = 0;
+        int length = 0;
+    };
+
+    static int indexOf(int semitoneOffset, int detuneStep) noexcept
+    {
+        if (semitoneOffset < minSemitoneOffset || semitoneOffset > maxSemitoneOffset || detuneStep < 0 || detuneStep >= numDetuneSteps)
+            return -1;
+
+        return (semitoneOffset - minSemitoneOffset) * numDetuneSteps + detuneStep;
+    }
+
+    Tile tileAt(const Entry& entry) const noexcept
+    {
+        Tile tile;
+        tile.numChannels = storage.getNumChannels();
+        tile.numSamples = entry.length;
+        for (int ch = 0; ch < tile.numChannels; ++ch)
+            tile.channels[ch] = const_cast<float*>(storage.getReadPointer(ch, entry.start));
+        return tile;
+    }
+
+    juce::AudioBuffer<float> storage;
+    std::array<Entry, numSemitoneOffsets * numDetuneSteps> entries;
+    Settings settings;
+    int used = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(TileCache)
+};
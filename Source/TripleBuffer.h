@@ -0,0 +1,55 @@
+// TripleBuffer.h
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Hands the latest value from one writer thread to one reader thread. The writer fills its own slot
+// and publishes it by swapping it with the shared middle slot; the reader swaps the middle slot for
+// its own when something new is there. Neither side blocks or allocates, and the reader only ever
+// sees complete values. Slots are reused, so size them once in prepareToPlay.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+
+    // Writer side
+    T& getWriteBuffer() noexcept { return slots[static_cast<size_t>(writeIndex)]; }
+
+    void publish() noexcept
+    {
+        writeIndex = middle.exchange(writeIndex | freshFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader side: takes the most recently published value if there's one newer than the last. Returns true if so.
+    bool pull() noexcept
+    {
+        if ((middle.load(std::memory_order_relaxed) & freshFlag) == 0)
+            return false;
+
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    const T& read() const noexcept { return slots[static_cast<size_t>(readIndex)]; }
+
+    // Message thread only, with neither side running, e.g. to preallocate every slot.
+    template <typename Function>
+    void forEachSlot(Function&& function)
+    {
+        for (auto& slot : slots)
+            function(slot);
+    }
+
+private:
+    static constexpr int indexMask = 3;
+    static constexpr int freshFlag = 4;
+
+    std::array<T, 3> slots;
+    int writeIndex = 0;
+    std::atomic<int> middle{ 1 };
+    int readIndex = 2;
+
+    JUCE_DECLARE_NON_COPYABLE(TripleBuffer)
+};
@@ -0,0 +1,447 @@
+// Main.cpp - countertune_bench
+//
+// Times the DSP hot paths and prints the results as JSON, so a change can be gated on numbers:
+//
+//   resample          the pitch shifter at each quality, across ratios and source lengths
+//   pitch_frame       one dywapitchtrack frame at 44.1/96/192 kHz
+//   isolate_best_note tracking note runs over a long cycle of frames, then extracting the voice
+//   tile_spawn        starting a grain over a fading one and mixing a block, cached and resampled
+//   process_block     the whole processor at 32/64/256/1024-sample blocks and 44.1/96/192 kHz
+//   harmony_voices    the whole processor at 44.1 kHz with 1, 2, 4 and 8 harmony voices
+//
+// Each result has ns_per_sample (ns per history frame for isolate_best_note) and the worst single
+// call in microseconds. process_block also reports that worst block as a fraction of its real-time budget.
+//
+//   countertune_bench [--out results.json] [--quick]
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+namespace
+{
+    struct Timings
+    {
+        double totalSeconds = 0.0;
+        double worstSeconds = 0.0;
+        int iterations = 0;
+    };
+
+    // Runs fn once untimed to warm caches, then `iterations` timed calls.
+    template <typename Function>
+    Timings measure(int iterations, Function&& fn)
+    {
+        fn();
+
+        Timings timings;
+        for (int i = 0; i < iterations; ++i)
+        {
+            const auto start = juce::Time::getHighResolutionTicks();
+            fn();
+            const double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+            timings.totalSeconds += seconds;
+            timings.worstSeconds = juce::jmax(timings.worstSeconds, seconds);
+        }
+        timings.iterations = iterations;
+        return timings;
+    }
+
+    class Report
+    {
+    public:
+        // Adds a result; unitsPerCall is how many samples (or frames) one timed call processes.
+        juce::DynamicObject::Ptr add(const juce::String& benchmark, const Timings& timings, double unitsPerCall, const juce::String& unit = "sample")
+        {
+            juce::DynamicObject::Ptr result = new juce::DynamicObject();
+            result->setProperty("benchmark", benchmark);
+            result->setProperty("iterations", timings.iterations);
+            result->setProperty("per", unit);
+            result->setProperty("ns_per_" + unit, timings.totalSeconds * 1.0e9 / (unitsPerCall * timings.iterations));
+            result->setProperty("worst_block_us", timings.worstSeconds * 1.0e6);
+            results.add(juce::var(result.get()));
+            return result;
+        }
+
+        juce::String toJson() const
+        {
+            juce::DynamicObject::Ptr system = new juce::DynamicObject();
+            system->setProperty("cpu", juce::SystemStats::getCpuModel());
+            system->setProperty("cores", juce::SystemStats::getNumCpus());
+            system->setProperty("os", juce::SystemStats::getOperatingSystemName());
+            system->setProperty("juce", juce::SystemStats::getJUCEVersion());
+           #if JUCE_DEBUG
+            system->setProperty("build", "debug");
+           #else
+            system->setProperty("build", "release");
+           #endif
+
+            juce::DynamicObject::Ptr root = new juce::DynamicObject();
+            root->setProperty("system", juce::var(system.get()));
+            root->setProperty("results", results);
+            return juce::JSON::toString(juce::var(root.get()));
+        }
+
+    private:
+        juce::Array<juce::var> results;
+    };
+
+    // A sung-ish test signal: held notes with a little vibrato, an attack and release on each, and some noise.
+    void fillMelody(juce::AudioBuffer<float>& buffer, double sampleRate, int startNote = 57)
+    {
+        juce::Random random(1234);
+        const int noteSamples = static_cast<int>(sampleRate * 0.4);
+        const int fadeSamples = static_cast<int>(sampleRate * 0.02);
+        double phase = 0.0;
+        int note = startNote;
+
+        for (int i = 0; i < buffer.getNumSamples(); ++i)
+        {
+            const int inNote = i % noteSamples;
+            if (inNote == 0)
+                note = startNote + random.nextInt(12);
+
+            const double vibrato = 0.1 * std::sin(juce::MathConstants<double>::twoPi * 5.5 * i / sampleRate);
+            const double frequency = 440.0 * std::pow(2.0, (note + vibrato - 69.0) / 12.0);
+            phase += juce::MathConstants<double>::twoPi * frequency / sampleRate;
+
+            const float envelope = static_cast<float>(juce::jmin(1, inNote / juce::jmax(1, fadeSamples), (noteSamples - inNote) / juce::jmax(1, fadeSamples)));
+            const float sample = 0.5f * envelope * static_cast<float>(std::sin(phase)) + 0.01f * (random.nextFloat() - 0.5f);
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+                buffer.setSample(ch, i, sample);
+        }
+    }
+}
+
+// Friend of the processor: sets up and calls its private hot paths.
+class ProcessorBenchmark
+{
+public:
+    // Prepared for offline use, so no analysis worker runs alongside the timing.
+    static void prepareOffline(CounterTune_v2AudioProcessor& processor, double sampleRate, int blockSize)
+    {
+        processor.setNonRealtime(true);
+        processor.setPlayConfigDetails(2, 2, sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+    }
+
+    static int runFramesFor(const CounterTune_v2AudioProcessor& p)
+    {
+        return (NoteRunTracker::minRunFrames * p.pitchAnalyzer.getFrameSize()) / p.pitchAnalyzer.getHopSize() + 2;
+    }
+
+    // A recording whose only usable run is at the very end of a cycle of numFrames frames.
+    static void prepareNoteHistory(CounterTune_v2AudioProcessor& p, int numFrames)
+    {
+        // The recording ends just after the run, so the voice is inside the capture ring
+        const juce::int64 runStart = static_cast<juce::int64>(numFrames - runFramesFor(p)) * p.pitchAnalyzer.getHopSize();
+        p.inputAudioBuffer_cycleStartSample = 0;
+        p.inputAudioBuffer_endSample = runStart + 4 * p.pitchAnalyzer.getFrameSize();
+        fillMelody(p.inputAudioBuffer, p.getSampleRate());
+    }
+
+    // Feeds the cycle's frames to the run tracker, one-frame notes until the run, then extracts the voice.
+    static void trackAndIsolateBestNote(CounterTune_v2AudioProcessor& p, int numFrames)
+    {
+        const int hopSize = p.pitchAnalyzer.getHopSize();
+        const int runFrames = runFramesFor(p);
+
+        p.noteRuns.startCycle(p.pitchAnalyzer.getFrameSize());
+        for (int i = 0; i < numFrames; ++i)
+        {
+            const int note = i < numFrames - runFrames ? 60 + (i & 1) : 64;
+            p.noteRuns.addFrame(note, true, static_cast<juce::int64>(i) * hopSize);
+        }
+        p.isolateBestNote();
+    }
+
+    // Installs a voice for the audio thread, and optionally a tile cache built for it and the given melody.
+    static void installVoice(CounterTune_v2AudioProcessor& p, bool withTileCache, const std::vector<int>& melody)
+    {
+        auto& voice = p.voiceBuffers[0];
+        voice.setSize(2, p.maxVoiceSamples, false, true, true);
+        fillMelody(voice, p.getSampleRate(), 60);
+        p.bellCurve(voice);
+        p.voiceBufferIndex = 0;
+        p.voiceGeneration = 1;
+        p.voiceNoteNumber.store(60);
+
+        p.currentTileCache->clear({});
+        if (withTileCache)
+        {
+            p.cacheVoice.makeCopyOf(voice, true);
+            p.cacheVoiceNote = 60;
+            p.cacheVoiceGeneration = p.voiceGeneration;
+            p.cacheMelody = melody;
+            p.rebuildTileCache();
+            if (auto* cache = p.pendingTileCache.exchange(nullptr))
+            {
+                p.retiredTileCache.store(p.currentTileCache);
+                p.currentTileCache = cache;
+            }
+        }
+    }
+
+    // One spawn as processBlock does it: fade out what's playing, start the next grain, mix a block.
+    static void spawnAndMix(CounterTune_v2AudioProcessor& p, juce::AudioBuffer<float>& block, int semitoneOffset, int detuneStep)
+    {
+        p.grains.stopAll();
+        p.harmonyLeadGrains[0] = p.startVoiceGrain(0, TileCache::unshiftedStep, 0);
+
+        const int fadeLength = p.maxVoiceSamples / 2;
+        p.grains.fadeOutAll(fadeLength);
+        p.harmonyLeadGrains[0] = p.startVoiceGrain(semitoneOffset, detuneStep, fadeLength);
+
+        block.clear();
+        const auto quality = static_cast<ResamplingEngine::Quality>(juce::jlimit(0, 2, p.getQualityInt()));
+        jassert(block.getNumChannels() == 2);
+        p.grains.process<2>(p.resampler, quality, p.tileCrossfade, block.getArrayOfWritePointers(), block.getNumSamples());
+    }
+};
+
+namespace
+{
+    const char* qualityNames[] = { "draft", "normal", "high" };
+
+    void benchmarkResample(Report& report, bool quick)
+    {
+        ResamplingEngine engine;
+        engine.prepare();
+
+        const double ratios[] = { 0.5, 0.749, 1.0, 1.335, 2.0 };
+        const int lengths[] = { 2048, 16384, 131072 };
+
+        for (int length : lengths)
+        {
+            juce::AudioBuffer<float> source(2, length);
+            fillMelody(source, 44100.0);
+
+            for (double ratio : ratios)
+            {
+                const int outputLength = Resampler::getOutputLength(length, ratio);
+                juce::AudioBuffer<float> output(2, outputLength);
+                juce::AudioBuffer<float> reference(2, outputLength);
+                const int iterations = juce::jmax(3, (quick ? 200000 : 2000000) / outputLength);
+
+                auto addResult = [&](const juce::String& kernel, const Timings& timings)
+                {
+                    auto result = report.add("resample", timings, outputLength);
+                    result->setProperty("kernel", kernel);
+                    result->setProperty("ratio", ratio);
+                    result->setProperty("source_samples", length);
+                    return result;
+                };
+
+                for (int q = 0; q < 3; ++q)
+                {
+                    const auto quality = static_cast<ResamplingEngine::Quality>(q);
+                    addResult(qualityNames[q], measure(iterations, [&]
+                    {
+                        engine.render(quality, Resampler::sourceOf(source), Resampler::destinationOf(output), 0, outputLength, ratio, 0.0);
+                    }));
+                }
+
+                // The scalar linear kernel the vectorised draft path must match, with the difference between them
+                auto result = addResult("draft_scalar_reference", measure(iterations, [&]
+                {
+                    Resampler::renderReference(Resampler::sourceOf(source), Resampler::destinationOf(reference), 0, outputLength, ratio, 0.0);
+                }));
+
+                engine.render(ResamplingEngine::Quality::draft, Resampler::sourceOf(source), Resampler::destinationOf(output), 0, outputLength, ratio, 0.0);
+                float maxError = 0.0f;
+                for (int ch = 0; ch < 2; ++ch)
+                    for (int i = 0; i < outputLength; ++i)
+                        maxError = juce::jmax(maxError, std::abs(output.getSample(ch, i) - reference.getSample(ch, i)));
+                result->setProperty("max_error_vs_draft", maxError);
+            }
+        }
+    }
+
+    void benchmarkPitchFrame(Report& report, bool quick)
+    {
+        for (double sampleRate : { 44100.0, 96000.0, 192000.0 })
+        {
+            const int frameSize = dywapitch_framesizeforsamplerate(1024, sampleRate);
+            juce::AudioBuffer<float> signal(1, frameSize * 64);
+            fillMelody(signal, sampleRate);
+
+            juce::HeapBlock<char> workspaceMemory(static_cast<size_t>(dywapitch_neededworkspace(frameSize)));
+            dywapitchworkspace workspace{};
+            dywapitch_initworkspace(&workspace, workspaceMemory.get(), frameSize);
+            dywapitchtracker tracker;
+            dywapitch_inittracking(&tracker);
+
+            int frame = 0;
+            auto result = report.add("pitch_frame", measure(quick ? 200 : 2000, [&]
+            {
+                const float* samples = signal.getReadPointer(0, (frame++ % 63) * frameSize);
+                dywapitch_computepitchf(&tracker, &workspace, samples, 0, frameSize, sampleRate);
+            }), frameSize);
+            result->setProperty("sample_rate", sampleRate);
+            result->setProperty("frame_size", frameSize);
+        }
+    }
+
+    void benchmarkIsolateBestNote(Report& report, bool quick)
+    {
+        CounterTune_v2AudioProcessor processor;
+        ProcessorBenchmark::prepareOffline(processor, 44100.0, 512);
+
+        for (int numFrames : { 1000, 10000, 100000 })
+        {
+            ProcessorBenchmark::prepareNoteHistory(processor, numFrames);
+            auto result = report.add("isolate_best_note", measure(quick ? 5 : 50, [&]
+            {
+                ProcessorBenchmark::trackAndIsolateBestNote(processor, numFrames);
+            }), numFrames, "frame");
+            result->setProperty("history_frames", numFrames);
+        }
+
+        processor.releaseResources();
+    }
+
+    void benchmarkTileSpawn(Report& report, bool quick)
+    {
+        constexpr int blockSize = 256;
+        const std::vector<int> melody{ 60, 63, -2, -2 };
+
+        for (int q = 0; q < 3; ++q)
+        {
+            for (bool cached : { false, true })
+            {
+                CounterTune_v2AudioProcessor processor;
+                processor.setQualityInt(q);
+                ProcessorBenchmark::prepareOffline(processor, 44100.0, blockSize);
+                ProcessorBenchmark::installVoice(processor, cached, melody);
+
+                juce::AudioBuffer<float> block(2, blockSize);
+                auto result = report.add("tile_spawn", measure(quick ? 200 : 2000, [&]
+                {
+                    ProcessorBenchmark::spawnAndMix(processor, block, 3, 5);
+                }), blockSize);
+                result->setProperty("quality", qualityNames[q]);
+                result->setProperty("cached", cached);
+
+                processor.releaseResources();
+            }
+        }
+    }
+
+    void benchmarkProcessBlock(Report& report, bool quick)
+    {
+        const double seconds = quick ? 4.0 : 30.0;
+
+        for (double sampleRate : { 44100.0, 96000.0, 192000.0 })
+        {
+            juce::AudioBuffer<float> input(2, static_cast<int>(sampleRate * seconds));
+            fillMelody(input, sampleRate);
+
+            for (int blockSize : { 32, 64, 256, 1024 })
+            {
+                // Real-time mode: the analysis worker runs on its own thread, as it does in a host
+                CounterTune_v2AudioProcessor processor;
+                processor.setPlayConfigDetails(2, 2, sampleRate, blockSize);
+                processor.prepareToPlay(sampleRate, blockSize);
+
+                juce::AudioBuffer<float> block(2, blockSize);
+                juce::MidiBuffer midi;
+                const int numBlocks = input.getNumSamples() / blockSize;
+                int blockIndex = 0;
+
+                auto timings = measure(numBlocks - 1, [&]
+                {
+                    for (int ch = 0; ch < 2; ++ch)
+                        block.copyFrom(ch, 0, input, ch, blockIndex * blockSize, blockSize);
+                    ++blockIndex;
+                    processor.processBlock(block, midi);
+                });
+
+                processor.releaseResources();
+
+                auto result = report.add("process_block", timings, blockSize);
+                result->setProperty("sample_rate", sampleRate);
+                result->setProperty("block_size", blockSize);
+                result->setProperty("worst_block_budget", timings.worstSeconds / (blockSize / sampleRate));
+               #if COUNTERTUNE_PROFILING
+                result->setProperty("stages", juce::JSON::parse(processor.getStageProfiler().toJson()));
+               #endif
+            }
+        }
+    }
+
+    void benchmarkHarmonyVoices(Report& report, bool quick)
+    {
+        constexpr double sampleRate = 44100.0;
+        constexpr int blockSize = 256;
+        juce::AudioBuffer<float> input(2, static_cast<int>(sampleRate * (quick ? 4.0 : 30.0)));
+        fillMelody(input, sampleRate);
+
+        for (int voices : { 1, 2, 4, 8 })
+        {
+            // Offline, so every run hears the same notes and learns the same voice
+            CounterTune_v2AudioProcessor processor;
+            processor.setVoicesInt(voices);
+            processor.setNonRealtime(true);
+            processor.setPlayConfigDetails(2, 2, sampleRate, blockSize);
+            processor.prepareToPlay(sampleRate, blockSize);
+
+            juce::AudioBuffer<float> block(2, blockSize);
+            juce::MidiBuffer midi;
+            int blockIndex = 0;
+
+            auto timings = measure(input.getNumSamples() / blockSize - 1, [&]
+            {
+                for (int ch = 0; ch < 2; ++ch)
+                    block.copyFrom(ch, 0, input, ch, blockIndex * blockSize, blockSize);
+                ++blockIndex;
+                processor.processBlock(block, midi);
+            });
+
+            processor.releaseResources();
+
+            auto result = report.add("harmony_voices", timings, blockSize);
+            result->setProperty("voices", voices);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser; // the processor's parameter state expects a message manager
+
+    juce::File outputFile;
+    bool quick = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const auto arg = juce::String::fromUTF8(argv[i]);
+        if (arg == "--quick")
+            quick = true;
+        else if (arg == "--out" && i + 1 < argc)
+            outputFile = juce::File::getCurrentWorkingDirectory().getChildFile(juce::String::fromUTF8(argv[++i]));
+        else
+        {
+            std::cerr << "usage: countertune_bench [--out results.json] [--quick]" << std::endl;
+            return 1;
+        }
+    }
+
+    Report report;
+    benchmarkResample(report, quick);
+    benchmarkPitchFrame(report, quick);
+    benchmarkIsolateBestNote(report, quick);
+    benchmarkTileSpawn(report, quick);
+    benchmarkProcessBlock(report, quick);
+    benchmarkHarmonyVoices(report, quick);
+
+    const auto json = report.toJson();
+    if (outputFile == juce::File())
+    {
+        std::cout << json << std::endl;
+    }
+    else if (!outputFile.replaceWithText(json))
+    {
+        std::cerr << "Can't write " << outputFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
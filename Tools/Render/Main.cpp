@@ -0,0 +1,502 @@
+// Main.cpp - countertune_render
+//
+// Streams audio files through CounterTune_v2AudioProcessor offline, as fast as the machine allows, and writes
+// the result as WAV. Parameters are set from the command line by ID; several files render at once on a pool.
+//
+//   countertune_render [options] <input>...
+//
+//     --out <dir>        where results go (default: next to each input), named <input>_countertune.wav
+//     --block <n>        samples per processBlock call (default 512)
+//     --jobs <n>         files rendered at once (default: one per core)
+//     --bits <n>         output bit depth, 16/24/32 (default 24)
+//     --hop <n>          analysis hop in samples at 44.1 kHz
+//     --seed <n>         seed the processor's random source, so renders repeat exactly
+//     --script <file>    parameter changes during the render, one "<seconds> <parameter> <value>" per line
+//     --golden <dir>     compare each result with the file of the same name in dir; fail if they differ
+//     --tolerance <x>    largest sample difference that still matches the golden file (default 1e-4)
+//     --scales <file>    user scales, one "<name> = <semitones>" per line; they follow the built-in ones on --scale
+//     --<parameter> <v>  any plugin parameter by ID, e.g. --key 2 --scale 3 --quality High
+//
+// --tempo is also what the render's play head reports as the host tempo, since the processor follows the host.
+//
+// Regression check for DSP changes: render fixed inputs with a fixed --seed and --script into a golden
+// directory once, then render them again with --golden pointing at it. The exit code is non-zero if any
+// file is off by more than the tolerance. ctest runs this as countertune_golden on the fixtures in Tools/Tests/Data.
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+namespace
+{
+    struct RenderSettings
+    {
+        juce::File outputDirectory;
+        int blockSize = 512;
+        int numJobs = juce::SystemStats::getNumCpus();
+        int bitDepth = 24;
+        int hopSize = 0; // 0: processor default
+        double tempo = 120.0;
+        juce::StringPairArray parameterValues; // parameter ID -> text, applied through getValueForText()
+
+        bool seeded = false;
+        juce::int64 seed = 0;
+
+        struct ScriptEvent
+        {
+            double time = 0.0; // seconds
+            juce::String parameterID;
+            juce::String value;
+        };
+        std::vector<ScriptEvent> script; // sorted by time
+
+        juce::File goldenDirectory;
+        double tolerance = 1.0e-4;
+
+        juce::File scalesFile;
+    };
+
+    // The host side of the render: a transport that's always playing at the requested tempo.
+    class RenderPlayHead : public juce::AudioPlayHead
+    {
+    public:
+        RenderPlayHead(double bpmToUse, double sampleRateToUse) : bpm(bpmToUse), sampleRate(sampleRateToUse) {}
+
+        void setTimeInSamples(juce::int64 newTime) noexcept { timeInSamples = newTime; }
+        void setBpm(double newBpm) noexcept { bpm = newBpm; }
+
+        juce::Optional<PositionInfo> getPosition() const override
+        {
+            PositionInfo info;
+            info.setBpm(bpm);
+            info.setTimeInSamples(timeInSamples);
+            info.setTimeInSeconds(static_cast<double>(timeInSamples) / sampleRate);
+            info.setPpqPosition(static_cast<double>(timeInSamples) / sampleRate * bpm / 60.0);
+            info.setTimeSignature(juce::AudioPlayHead::TimeSignature{});
+            info.setIsPlaying(true);
+            return info;
+        }
+
+    private:
+        double bpm;
+        double sampleRate;
+        juce::int64 timeInSamples = 0;
+    };
+
+    juce::CriticalSection outputLock;
+
+    void log(const juce::String& message)
+    {
+        const juce::ScopedLock sl(outputLock);
+        std::cout << message << std::endl;
+    }
+
+    juce::File getOutputFile(const juce::File& input, const RenderSettings& settings)
+    {
+        const auto directory = settings.outputDirectory != juce::File() ? settings.outputDirectory : input.getParentDirectory();
+        return directory.getChildFile(input.getFileNameWithoutExtension() + "_countertune.wav");
+    }
+
+    bool setParameter(CounterTune_v2AudioProcessor& processor, const juce::String& id, const juce::String& value)
+    {
+        auto* param = processor.parameters.getParameter(id);
+        if (param == nullptr)
+            return false;
+
+        param->setValueNotifyingHost(param->getValueForText(value));
+        return true;
+    }
+
+    bool applyParameters(CounterTune_v2AudioProcessor& processor, const RenderSettings& settings)
+    {
+        for (const auto& id : settings.parameterValues.getAllKeys())
+        {
+            if (!setParameter(processor, id, settings.parameterValues[id]))
+                return false;
+        }
+
+        if (settings.hopSize > 0)
+            processor.setAnalysisHopSize(settings.hopSize);
+
+        return true;
+    }
+
+    // Largest sample difference between a render and its golden file; false (after saying why) if they don't match.
+    bool compareWithGolden(juce::AudioFormatManager& formatManager, const juce::File& rendered, const juce::File& golden, double tolerance)
+    {
+        std::unique_ptr<juce::AudioFormatReader> renderedReader(formatManager.createReaderFor(rendered));
+        std::unique_ptr<juce::AudioFormatReader> goldenReader(formatManager.createReaderFor(golden));
+        if (renderedReader == nullptr || goldenReader == nullptr)
+        {
+            log("Can't read " + (renderedReader == nullptr ? rendered : golden).getFullPathName());
+            return false;
+        }
+
+        if (renderedReader->numChannels != goldenReader->numChannels || renderedReader->lengthInSamples != goldenReader->lengthInSamples
+            || renderedReader->sampleRate != goldenReader->sampleRate)
+        {
+            log(rendered.getFileName() + " doesn't match the format or length of " + golden.getFullPathName());
+            return false;
+        }
+
+        constexpr int chunkSize = 65536;
+        const int numChannels = static_cast<int>(renderedReader->numChannels);
+        juce::AudioBuffer<float> renderedChunk(numChannels, chunkSize), goldenChunk(numChannels, chunkSize);
+        float maxDifference = 0.0f;
+        juce::int64 maxDifferenceAt = 0;
+
+        for (juce::int64 position = 0; position < renderedReader->lengthInSamples; position += chunkSize)
+        {
+            const int numSamples = static_cast<int>(juce::jmin<juce::int64>(chunkSize, renderedReader->lengthInSamples - position));
+            renderedReader->read(&renderedChunk, 0, numSamples, position, true, true);
+            goldenReader->read(&goldenChunk, 0, numSamples, position, true, true);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                const float* a = renderedChunk.getReadPointer(ch);
+                const float* b = goldenChunk.getReadPointer(ch);
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    const float difference = std::abs(a[i] - b[i]);
+                    if (difference > maxDifference)
+                    {
+                        maxDifference = difference;
+                        maxDifferenceAt = position + i;
+                    }
+                }
+            }
+        }
+
+        const bool matches = maxDifference <= tolerance;
+        log(rendered.getFileName() + (matches ? " matches " : " DIFFERS from ") + golden.getFullPathName()
+            + ": max difference " + juce::String(maxDifference, 8) + " at sample " + juce::String(maxDifferenceAt));
+        return matches;
+    }
+
+    bool renderFile(const juce::File& input, const RenderSettings& settings)
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(input));
+        if (reader == nullptr)
+        {
+            log("Can't read " + input.getFullPathName());
+            return false;
+        }
+
+        const auto outputFile = getOutputFile(input, settings);
+        outputFile.deleteFile();
+        auto stream = outputFile.createOutputStream();
+        if (stream == nullptr)
+        {
+            log("Can't write " + outputFile.getFullPathName());
+            return false;
+        }
+
+        const double sampleRate = reader->sampleRate;
+        const int fileChannels = static_cast<int>(reader->numChannels);
+        const int outputChannels = juce::jmin(fileChannels, 2);
+
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), sampleRate, static_cast<unsigned int>(outputChannels),
+                                                                           settings.bitDepth, {}, 0));
+        if (writer == nullptr)
+        {
+            log("Can't write " + outputFile.getFullPathName() + " at " + juce::String(settings.bitDepth) + " bits");
+            return false;
+        }
+        stream.release(); // the writer owns it now
+
+        CounterTune_v2AudioProcessor processor;
+        if (!applyParameters(processor, settings))
+        {
+            log("Unknown parameter for " + input.getFullPathName());
+            return false;
+        }
+        if (settings.seeded)
+            processor.setRandomSeed(settings.seed);
+        if (settings.scalesFile != juce::File())
+        {
+            const auto error = processor.loadUserScales(settings.scalesFile);
+            if (error.isNotEmpty())
+            {
+                log(settings.scalesFile.getFullPathName() + ": " + error);
+                return false;
+            }
+        }
+
+        // The processor is always run in stereo; a mono file feeds both channels and gets the left one back
+        RenderPlayHead playHead(settings.tempo, sampleRate);
+        processor.setPlayHead(&playHead);
+        processor.setNonRealtime(true);
+        processor.setPlayConfigDetails(2, 2, sampleRate, settings.blockSize);
+        processor.prepareToPlay(sampleRate, settings.blockSize);
+
+        juce::AudioBuffer<float> buffer(2, settings.blockSize);
+        juce::MidiBuffer midi;
+
+        const auto startTime = juce::Time::getMillisecondCounterHiRes();
+        bool ok = true;
+        size_t nextScriptEvent = 0;
+
+        for (juce::int64 position = 0; position < reader->lengthInSamples;)
+        {
+            // Scripted changes land on the first block starting at or after their time
+            for (; nextScriptEvent < settings.script.size() && settings.script[nextScriptEvent].time * sampleRate <= static_cast<double>(position); ++nextScriptEvent)
+            {
+                const auto& event = settings.script[nextScriptEvent];
+                setParameter(processor, event.parameterID, event.value);
+                if (event.parameterID == "tempo")
+                    playHead.setBpm(juce::jlimit<double>(CounterTune_v2AudioProcessor::minTempo, CounterTune_v2AudioProcessor::maxTempo, event.value.getDoubleValue()));
+            }
+
+            const int numSamples = static_cast<int>(juce::jmin<juce::int64>(settings.blockSize, reader->lengthInSamples - position));
+            buffer.setSize(2, numSamples, false, false, true);
+            buffer.clear();
+
+            reader->read(&buffer, 0, numSamples, position, true, fileChannels > 1);
+            if (fileChannels == 1)
+                buffer.copyFrom(1, 0, buffer, 0, 0, numSamples);
+
+            playHead.setTimeInSamples(position);
+            midi.clear();
+            processor.processBlock(buffer, midi);
+
+            if (!writer->writeFromAudioSampleBuffer(buffer, 0, numSamples))
+            {
+                log("Write failed for " + outputFile.getFullPathName());
+                ok = false;
+                break;
+            }
+
+            position += numSamples;
+        }
+
+        processor.releaseResources();
+        processor.setPlayHead(nullptr);
+        writer.reset();
+
+        const double seconds = (juce::Time::getMillisecondCounterHiRes() - startTime) * 0.001;
+        const double audioSeconds = static_cast<double>(reader->lengthInSamples) / sampleRate;
+        if (ok)
+        {
+            log(input.getFileName() + " -> " + outputFile.getFullPathName() + ": "
+                + juce::String(audioSeconds, 2) + " s in " + juce::String(seconds, 2) + " s ("
+                + juce::String(seconds > 0.0 ? audioSeconds / seconds : 0.0, 1) + "x real time)");
+        }
+
+        if (ok && settings.goldenDirectory != juce::File())
+            ok = compareWithGolden(formatManager, outputFile, settings.goldenDirectory.getChildFile(outputFile.getFileName()), settings.tolerance);
+
+        return ok;
+    }
+
+    void printUsage()
+    {
+        std::cout << "usage: countertune_render [options] <input>...\n"
+                     "  --out <dir>        output directory (default: next to each input)\n"
+                     "  --block <n>        samples per processBlock call (default 512)\n"
+                     "  --jobs <n>         files rendered at once (default: one per core)\n"
+                     "  --bits <n>         output bit depth, 16/24/32 (default 24)\n"
+                     "  --hop <n>          analysis hop in samples at 44.1 kHz\n"
+                     "  --seed <n>         seed the random source, so renders repeat exactly\n"
+                     "  --script <file>    parameter changes, one \"<seconds> <parameter> <value>\" per line\n"
+                     "  --golden <dir>     compare each result with the file of the same name in dir\n"
+                     "  --tolerance <x>    largest sample difference that still matches (default 1e-4)\n"
+                     "  --scales <file>    user scales, one \"<name> = <semitones>\" per line\n"
+                     "  --<parameter> <v>  plugin parameter by ID:";
+
+        CounterTune_v2AudioProcessor processor;
+        for (auto* param : processor.getParameters())
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(param))
+                std::cout << " " << ranged->getParameterID();
+
+        std::cout << std::endl;
+    }
+
+    // Reads a parameter script: "<seconds> <parameter> <value>" per line, # starts a comment.
+    bool loadScript(const juce::File& file, const juce::StringArray& parameterIDs, RenderSettings& settings)
+    {
+        if (!file.existsAsFile())
+        {
+            std::cerr << "No such script: " << file.getFullPathName() << std::endl;
+            return false;
+        }
+
+        juce::StringArray lines;
+        lines.addLines(file.loadFileAsString());
+        for (int i = 0; i < lines.size(); ++i)
+        {
+            const auto line = lines[i].upToFirstOccurrenceOf("#", false, false).trim();
+            if (line.isEmpty())
+                continue;
+
+            juce::StringArray tokens;
+            tokens.addTokens(line, " \t", "\"");
+            tokens.removeEmptyStrings();
+            if (tokens.size() != 3 || !parameterIDs.contains(tokens[1]))
+            {
+                std::cerr << file.getFileName() << ":" << (i + 1) << ": expected <seconds> <parameter> <value>" << std::endl;
+                return false;
+            }
+
+            settings.script.push_back({ tokens[0].getDoubleValue(), tokens[1], tokens[2].unquoted() });
+        }
+
+        std::stable_sort(settings.script.begin(), settings.script.end(),
+                         [](const RenderSettings::ScriptEvent& a, const RenderSettings::ScriptEvent& b) { return a.time < b.time; });
+        return true;
+    }
+
+    // Parses the command line into settings and input files. Returns false (after saying why) if it can't.
+    bool parseArguments(const juce::StringArray& args, RenderSettings& settings, juce::Array<juce::File>& inputs)
+    {
+        juce::StringArray parameterIDs;
+        {
+            CounterTune_v2AudioProcessor processor;
+            for (auto* param : processor.getParameters())
+                if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(param))
+                    parameterIDs.add(ranged->getParameterID());
+        }
+
+        for (int i = 0; i < args.size(); ++i)
+        {
+            const auto& arg = args[i];
+            if (!arg.startsWith("--"))
+            {
+                inputs.add(juce::File::getCurrentWorkingDirectory().getChildFile(arg));
+                continue;
+            }
+
+            // --name value or --name=value
+            auto name = arg.substring(2);
+            juce::String value;
+            if (name.contains("="))
+            {
+                value = name.fromFirstOccurrenceOf("=", false, false);
+                name = name.upToFirstOccurrenceOf("=", false, false);
+            }
+            else if (i + 1 < args.size())
+            {
+                value = args[++i];
+            }
+            else
+            {
+                std::cerr << "Missing value for " << arg << std::endl;
+                return false;
+            }
+
+            if (name == "out")
+                settings.outputDirectory = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (name == "block")
+                settings.blockSize = value.getIntValue();
+            else if (name == "jobs")
+                settings.numJobs = value.getIntValue();
+            else if (name == "bits")
+                settings.bitDepth = value.getIntValue();
+            else if (name == "hop")
+                settings.hopSize = value.getIntValue();
+            else if (name == "seed")
+            {
+                settings.seeded = true;
+                settings.seed = value.getLargeIntValue();
+            }
+            else if (name == "script")
+            {
+                if (!loadScript(juce::File::getCurrentWorkingDirectory().getChildFile(value), parameterIDs, settings))
+                    return false;
+            }
+            else if (name == "golden")
+                settings.goldenDirectory = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (name == "tolerance")
+                settings.tolerance = value.getDoubleValue();
+            else if (name == "scales")
+                settings.scalesFile = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (parameterIDs.contains(name))
+            {
+                settings.parameterValues.set(name, value);
+                if (name == "tempo")
+                    settings.tempo = juce::jlimit<double>(CounterTune_v2AudioProcessor::minTempo, CounterTune_v2AudioProcessor::maxTempo, value.getDoubleValue());
+            }
+            else
+            {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+
+        if (settings.blockSize < 1 || settings.numJobs < 1 || (settings.bitDepth != 16 && settings.bitDepth != 24 && settings.bitDepth != 32))
+        {
+            std::cerr << "--block and --jobs must be positive, --bits one of 16, 24 or 32" << std::endl;
+            return false;
+        }
+
+        if (inputs.isEmpty())
+        {
+            std::cerr << "No input files" << std::endl;
+            return false;
+        }
+
+        for (const auto& input : inputs)
+        {
+            if (!input.existsAsFile())
+            {
+                std::cerr << "No such file: " << input.getFullPathName() << std::endl;
+                return false;
+            }
+        }
+
+        if (settings.outputDirectory != juce::File() && settings.outputDirectory.createDirectory().failed())
+        {
+            std::cerr << "Can't create " << settings.outputDirectory.getFullPathName() << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser; // the processor's parameter state expects a message manager
+
+    juce::StringArray args;
+    for (int i = 1; i < argc; ++i)
+        args.add(juce::String::fromUTF8(argv[i]));
+
+    if (args.isEmpty() || args.contains("--help") || args.contains("-h"))
+    {
+        printUsage();
+        return args.isEmpty() ? 1 : 0;
+    }
+
+    RenderSettings settings;
+    juce::Array<juce::File> inputs;
+    if (!parseArguments(args, settings, inputs))
+        return 1;
+
+    // Each file gets its own processor, so jobs share nothing but the log
+    std::atomic<int> failures{ 0 };
+    {
+        juce::ThreadPool pool(juce::jmin(settings.numJobs, inputs.size()));
+        for (const auto& input : inputs)
+        {
+            pool.addJob([input, &settings, &failures]
+            {
+                if (!renderFile(input, settings))
+                    ++failures;
+            });
+        }
+
+        while (pool.getNumJobs() > 0)
+            juce::Thread::sleep(20);
+    }
+
+    if (failures.load() > 0)
+    {
+        std::cerr << failures.load() << " of " << inputs.size() << " files failed" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
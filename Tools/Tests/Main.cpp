@@ -0,0 +1,262 @@
+// Main.cpp - countertune_tests
+//
+// Unit tests for the DSP kernels, run by ctest. Exits non-zero if any test fails.
+//
+//   resampler   the vectorised linear kernel against its scalar reference, to within 1e-6
+//   grain pool  grains against their source rendered under the window they should have, split into blocks
+//               the way a host splits them, and a voice handed from one grain to the next
+//
+//   countertune_tests [--seed <n>]
+
+#include <JuceHeader.h>
+#include "GrainPool.h"
+
+namespace
+{
+    class ResamplerTests : public juce::UnitTest
+    {
+    public:
+        ResamplerTests() : juce::UnitTest("Resampler", "CounterTune") {}
+
+        void runTest() override
+        {
+            beginTest("render matches renderReference");
+            compareWithReference();
+        }
+
+    private:
+        static constexpr float tolerance = 1.0e-6f;
+        static constexpr int numTrials = 500;
+
+        void compareWithReference()
+        {
+            auto random = getRandom();
+
+            for (int trial = 0; trial < numTrials; ++trial)
+            {
+                // Lengths short and long, ratios either side of 1, and start phases that run off the end
+                const int numChannels = 1 + random.nextInt(2);
+                const int sourceSamples = 1 + random.nextInt(4096);
+                const double ratio = 0.05 + random.nextDouble() * 4.0;
+                const double startPhase = random.nextDouble() * sourceSamples * 0.75;
+                const int numSamples = random.nextInt(2048);
+                const int destOffset = random.nextInt(17);
+
+                juce::AudioBuffer<float> source(numChannels, sourceSamples);
+                fillWithNoise(source, random);
+
+                // Both destinations start with the same contents, so a sample either kernel skips shows up
+                juce::AudioBuffer<float> vectorised(numChannels, destOffset + numSamples);
+                fillWithNoise(vectorised, random);
+                juce::AudioBuffer<float> reference;
+                reference.makeCopyOf(vectorised);
+
+                const auto sourceView = Resampler::sourceOf(source);
+                const double vectorisedPhase = Resampler::render(sourceView, Resampler::destinationOf(vectorised), destOffset, numSamples, ratio, startPhase);
+                const double referencePhase = Resampler::renderReference(sourceView, Resampler::destinationOf(reference), destOffset, numSamples, ratio, startPhase);
+
+                expectEquals(vectorisedPhase, referencePhase, "returned read phase");
+
+                float maxError = 0.0f;
+                for (int ch = 0; ch < numChannels; ++ch)
+                {
+                    for (int i = 0; i < vectorised.getNumSamples(); ++i)
+                        maxError = juce::jmax(maxError, std::abs(vectorised.getSample(ch, i) - reference.getSample(ch, i)));
+                }
+                expectLessOrEqual(maxError, tolerance, "source " + juce::String(sourceSamples) + ", ratio " + juce::String(ratio)
+                                                           + ", start " + juce::String(startPhase) + ", " + juce::String(numSamples) + " samples");
+            }
+        }
+
+        static void fillWithNoise(juce::AudioBuffer<float>& buffer, juce::Random& random)
+        {
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            {
+                for (int i = 0; i < buffer.getNumSamples(); ++i)
+                    buffer.setSample(ch, i, random.nextFloat() * 2.0f - 1.0f);
+            }
+        }
+    };
+
+    ResamplerTests resamplerTests;
+
+    class GrainPoolTests : public juce::UnitTest
+    {
+    public:
+        GrainPoolTests() : juce::UnitTest("GrainPool", "CounterTune") {}
+
+        void runTest() override
+        {
+            beginTest("a grain plays its source under its window, across blocks");
+            compareWithWindowedSource();
+
+            beginTest("a voice handed to a new grain crossfades on complementary curves and ends with one grain");
+            handOverVoice();
+        }
+
+    private:
+        static constexpr float tolerance = 1.0e-5f; // the grain reads from position * rate, the reference sums i * rate
+        static constexpr int numTrials = 200;
+
+        ResamplingEngine engine; // draft only, which needs no tables
+        EqualPowerCrossfade crossfade;
+
+        void compareWithWindowedSource()
+        {
+            auto random = getRandom();
+
+            for (int trial = 0; trial < numTrials; ++trial)
+            {
+                // Pre-pitched tiles (rate 1, mixed straight from the source) and resampled grains, mono and stereo
+                const int numChannels = 1 + random.nextInt(2);
+                const int sourceSamples = 1 + random.nextInt(8192);
+                const double rate = random.nextBool() ? 1.0 : 0.5 + random.nextDouble() * 1.5;
+                const int length = Resampler::getOutputLength(sourceSamples, rate);
+                const int fadeInLength = random.nextInt(length + 1);
+                const float gain = 0.25f + random.nextFloat();
+                const int fadeOutAt = random.nextInt(length + 1);
+                const int fadeOutLength = random.nextInt(length + 1);
+
+                juce::AudioBuffer<float> source(numChannels, sourceSamples);
+                fillWithNoise(source, random);
+
+                // What it should sound like: the whole source resampled at once, times the window sample by sample
+                juce::AudioBuffer<float> expected(numChannels, length);
+                Resampler::renderReference(Resampler::sourceOf(source), Resampler::destinationOf(expected), 0, length, rate, 0.0);
+                const int fadeOutEnd = juce::jmin(length, fadeOutAt + juce::jmin(fadeOutLength, length - fadeOutAt));
+                for (int i = 0; i < length; ++i)
+                {
+                    float fadeIn = 1.0f, fadeOut = 1.0f, unused = 0.0f;
+                    if (i < fadeInLength)
+                        crossfade.fillGains(&fadeIn, &unused, 1, i, fadeInLength);
+                    if (i >= fadeOutAt)
+                        crossfade.fillGains(&unused, &fadeOut, 1, i - fadeOutAt, fadeOutEnd - fadeOutAt);
+                    if (i >= fadeOutEnd)
+                        fadeOut = 0.0f;
+
+                    for (int ch = 0; ch < numChannels; ++ch)
+                        expected.setSample(ch, i, expected.getSample(ch, i) * gain * fadeIn * fadeOut);
+                }
+
+                // The pool's version, in random blocks, told to fade out between two of them
+                GrainPool pool;
+                pool.start(Resampler::sourceOf(source), &source, rate, length, fadeInLength, gain);
+                juce::AudioBuffer<float> rendered(2, length + 1024);
+                rendered.clear();
+                for (int position = 0; position < rendered.getNumSamples();)
+                {
+                    if (position == fadeOutAt)
+                        pool.fadeOutAll(fadeOutLength);
+
+                    int numSamples = juce::jmin(1 + random.nextInt(600), rendered.getNumSamples() - position);
+                    if (position < fadeOutAt)
+                        numSamples = juce::jmin(numSamples, fadeOutAt - position); // a block boundary where the fade-out starts
+
+                    float* dest[2] = { rendered.getWritePointer(0, position), rendered.getWritePointer(1, position) };
+                    pool.process<2>(engine, ResamplingEngine::Quality::draft, crossfade, dest, numSamples);
+                    position += numSamples;
+                }
+
+                expect(pool.getNumActive() == 0, "the grain stops at its end");
+
+                float maxError = 0.0f;
+                for (int ch = 0; ch < 2; ++ch)
+                {
+                    const int sourceChannel = juce::jmin(ch, numChannels - 1); // a mono source plays on both sides
+                    for (int i = 0; i < rendered.getNumSamples(); ++i)
+                    {
+                        const float want = i < length ? expected.getSample(sourceChannel, i) : 0.0f;
+                        maxError = juce::jmax(maxError, std::abs(rendered.getSample(ch, i) - want));
+                    }
+                }
+                expectLessOrEqual(maxError, tolerance, "source " + juce::String(sourceSamples) + ", rate " + juce::String(rate)
+                                                           + ", fade in " + juce::String(fadeInLength) + ", fade out at "
+                                                           + juce::String(fadeOutAt) + " over " + juce::String(fadeOutLength));
+            }
+        }
+
+        void handOverVoice()
+        {
+            auto random = getRandom();
+
+            for (int trial = 0; trial < numTrials; ++trial)
+            {
+                // A constant source, so every output sample is just the sum of the two grains' gains
+                const int sourceSamples = 256 + random.nextInt(4096);
+                juce::AudioBuffer<float> source(1, sourceSamples);
+                juce::FloatVectorOperations::fill(source.getWritePointer(0), 1.0f, sourceSamples);
+
+                GrainPool pool;
+                const int outgoing = pool.start(Resampler::sourceOf(source), &source, 1.0, sourceSamples, 0);
+                const int played = random.nextInt(sourceSamples - 1);
+                juce::AudioBuffer<float> scratch(1, juce::jmax(1, played));
+                float* scratchChannel[1] = { scratch.getWritePointer(0) };
+                pool.process<1>(engine, ResamplingEngine::Quality::draft, crossfade, scratchChannel, played);
+
+                const int crossfadeLength = 1 + random.nextInt(sourceSamples - played);
+                const int incoming = pool.start(Resampler::sourceOf(source), &source, 1.0, sourceSamples, 0);
+                pool.crossfadeVoice(0, incoming, crossfadeLength);
+                expect(pool.getNumActive() == 2, "both grains play through the crossfade");
+
+                juce::AudioBuffer<float> rendered(1, crossfadeLength);
+                rendered.clear();
+                for (int position = 0; position < crossfadeLength;)
+                {
+                    const int n = juce::jmin(1 + random.nextInt(300), crossfadeLength - position);
+                    float* dest[1] = { rendered.getWritePointer(0, position) };
+                    pool.process<1>(engine, ResamplingEngine::Quality::draft, crossfade, dest, n);
+                    position += n;
+                }
+
+                float maxError = 0.0f;
+                for (int i = 0; i < crossfadeLength; ++i)
+                {
+                    float fadeIn = 0.0f, fadeOut = 0.0f;
+                    crossfade.fillGains(&fadeIn, &fadeOut, 1, i, crossfadeLength);
+                    maxError = juce::jmax(maxError, std::abs(rendered.getSample(0, i) - (fadeIn + fadeOut)));
+                }
+                expectLessOrEqual(maxError, tolerance, "crossfade over " + juce::String(crossfadeLength));
+
+                expect(pool.getNumActive() == 1 && pool.isActive(incoming) && !pool.isActive(outgoing),
+                       "only the incoming grain is left once the crossfade is over");
+            }
+        }
+
+        static void fillWithNoise(juce::AudioBuffer<float>& buffer, juce::Random& random)
+        {
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            {
+                for (int i = 0; i < buffer.getNumSamples(); ++i)
+                    buffer.setSample(ch, i, random.nextFloat() * 2.0f - 1.0f);
+            }
+        }
+    };
+
+    GrainPoolTests grainPoolTests;
+}
+
+int main(int argc, char* argv[])
+{
+    juce::int64 seed = 0; // 0: a random seed, which the runner prints so a failure can be repeated
+    for (int i = 1; i < argc; ++i)
+    {
+        const auto arg = juce::String::fromUTF8(argv[i]);
+        if (arg == "--seed" && i + 1 < argc)
+            seed = juce::String::fromUTF8(argv[++i]).getLargeIntValue();
+        else
+        {
+            std::cerr << "usage: countertune_tests [--seed <n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("CounterTune", seed);
+
+    int failures = 0;
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        failures += runner.getResult(i)->failures;
+
+    return failures > 0 ? 1 : 0;
+}